@@ -0,0 +1,159 @@
+#include "batch.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Batch {
+
+namespace {
+
+struct Job {
+  uint64_t seq;
+  std::string fen;
+};
+
+struct Slot {
+  bool ready = false;
+  std::string text;
+};
+
+std::mutex mtx;
+std::condition_variable cv;
+std::deque<Job> jobs;
+std::vector<Slot> window;   // results waiting for their turn, indexed by seq
+uint64_t nextOut = 0;       // first result not yet written
+bool inputDone = false;
+
+std::string json_escape(const std::string &in) {
+  std::string out;
+  for (char c : in) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c == '\n') {
+      out += "\\n";
+    } else if (c == '\r') {
+      out += "\\r";
+    } else if (c == '\t') {
+      out += "\\t";
+    } else if ((unsigned char)c < 0x20) {
+      char buff[8];
+      snprintf(buff, sizeof(buff), "\\u%04x", (unsigned char)c);
+      out += buff;
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+std::string analyse(DarkChess::Board &board, Search::Context &ctx, const std::string &fen) {
+  char buff[512];
+  try {
+    board.set_from_FEN(fen);
+  } catch (const std::exception &e) {
+    snprintf(buff, sizeof(buff), "{\"fen\":\"%s\",\"error\":\"%s\"}", json_escape(fen).c_str(),
+             json_escape(e.what()).c_str());
+    return buff;
+  }
+
+  auto start = std::chrono::system_clock::now();
+  Search::iterDeep(ctx, board);
+  std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
+
+  std::string move = "null";
+  if (ctx.bestMove != DarkChess::MOVE_NULL) {
+    move = "\"" + board.print_move(ctx.bestMove) + "\"";
+  }
+  snprintf(buff, sizeof(buff),
+           "{\"fen\":\"%s\",\"bestmove\":%s,\"score\":%d,\"depth\":%d,\"nodes\":%llu,\"evalhits\":%.3f,\"time_ms\":%d}",
+           json_escape(fen).c_str(), move.c_str(), ctx.bestScore, ctx.depth, (unsigned long long)ctx.nodes,
+           ctx.evalProbes ? double(ctx.evalHits) / ctx.evalProbes : 0.0, int(elapsed.count() * 1000));
+  return buff;
+}
+
+void worker(Search::Limits limits) {
+  DarkChess::Board board;
+  Search::Context ctx;
+  ctx.limits = limits;
+
+  for (;;) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      cv.wait(lock, [] { return inputDone || !jobs.empty(); });
+      if (jobs.empty()) return;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+
+    std::string text = analyse(board, ctx, job.fen);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    Slot &slot = window[job.seq % window.size()];
+    slot.text = std::move(text);
+    slot.ready = true;
+    // Whoever completes the oldest pending position writes out the run
+    // of finished results behind it
+    bool advanced = false;
+    while (window[nextOut % window.size()].ready) {
+      Slot &out = window[nextOut % window.size()];
+      fprintf(stdout, "%s\n", out.text.c_str());
+      out.ready = false;
+      out.text.clear();
+      nextOut++;
+      advanced = true;
+    }
+    if (advanced) {
+      fflush(stdout);
+      cv.notify_all();
+    }
+  }
+}
+
+} // namespace
+
+int run(const char* path, const Search::Limits &limits, int threads) {
+  FILE* in = stdin;
+  if (path && strcmp(path, "-")) {
+    in = fopen(path, "r");
+    if (!in) {
+      fprintf(stderr, "cannot open %s\n", path);
+      return 1;
+    }
+  }
+
+  window.assign(4 * threads, Slot());
+  std::vector<std::thread> pool;
+  for (int i = 0; i < threads; i++) {
+    pool.emplace_back(worker, limits);
+  }
+
+  char read[1024];
+  uint64_t seq = 0;
+  while (fgets(read, sizeof(read), in) != NULL) {
+    read[strcspn(read, "\r\n")] = '\0';
+    if (read[0] == '\0' || read[0] == '#') continue;
+
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [&] { return seq < nextOut + window.size(); });
+    jobs.push_back(Job{seq++, read});
+    cv.notify_all();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    inputDone = true;
+  }
+  cv.notify_all();
+  for (auto &t : pool) t.join();
+
+  if (in != stdin) fclose(in);
+  return 0;
+}
+
+} // namespace Batch
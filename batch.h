@@ -0,0 +1,18 @@
+#pragma once
+
+#include "search.h"
+
+/*
+ * Batch mode: analyse a file of positions offline.
+ *
+ * Each input line is a FEN as accepted by Board::set_from_FEN. Positions
+ * are searched by a pool of workers, each with its own Board and search
+ * context, and one JSON object per position is written to stdout in input
+ * order. At most a fixed window of positions is in flight, so memory does
+ * not grow with the input.
+ */
+namespace Batch {
+
+int run(const char* path, const Search::Limits &limits, int threads);
+
+} // namespace Batch
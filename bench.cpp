@@ -0,0 +1,51 @@
+#include "bench.h"
+#include "evalcache.h"
+
+namespace Bench {
+
+static const char* positions[] = {
+  "dddd/dddd/dddd/dddd/dddd/dddd/dddd/dddd r 0",
+  "dddd/dkdd/dddd/ddPd/dddd/dddd/dddd/dddd r 2",
+  "dCdd/ddgd/Rddd/dpdd/ddMd/dNdd/ddcd/dddd b 12",
+  "2d1/1dp1/Cd2/4/d1N1/1m2/4/d3 r 40",
+  "4/1k2/2G1/4/3p/1C2/4/r3 r 70",
+  "gm2/1P2/2K1/4/p3/4/1N2/3c b 80",
+  "4/4/4/1k2/4/2P1/4/4 r 20",
+  "k3/4/4/4/4/4/4/3K r 100"
+};
+
+int run(Search::Limits limits, unsigned seed) {
+  const int count = sizeof(positions) / sizeof(positions[0]);
+  DarkChess::Board board;
+  Search::Context ctx;
+  ctx.rng.seed(seed);
+  ctx.limits = limits;
+  ctx.limits.time = 0;
+  if (ctx.limits.depth == 0 && ctx.limits.nodes == 0) {
+    ctx.limits.depth = 12;
+  }
+
+  Search::tt.clear();
+  DarkChess::evalCache.clear();
+  uint64_t evalProbes = 0, evalHits = 0;
+  auto start = std::chrono::system_clock::now();
+  for (int i = 0; i < count; i++) {
+    board.set_from_FEN(positions[i]);
+    Search::iterDeep(ctx, board);
+    evalProbes += ctx.evalProbes;
+    evalHits += ctx.evalHits;
+    printf("position %d/%d: depth %d nodes %llu bestmove %s\n", i + 1, count, ctx.depth,
+           (unsigned long long)ctx.nodes,
+           ctx.bestMove == DarkChess::MOVE_NULL ? "none" : board.print_move(ctx.bestMove).c_str());
+  }
+  std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
+
+  printf("\nTotal time (ms) : %d\n", int(elapsed.count() * 1000));
+  printf("Nodes searched  : %llu\n", (unsigned long long)ctx.totalNodes);
+  printf("Nodes/second    : %llu\n", (unsigned long long)(ctx.totalNodes / std::max(elapsed.count(), 1e-3)));
+  printf("Eval cache hits : %.1f%%\n", evalProbes ? 100.0 * evalHits / evalProbes : 0.0);
+  printf("Signature       : %016llx\n", (unsigned long long)ctx.signature);
+  return 0;
+}
+
+} // namespace Bench
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "search.h"
+
+/*
+ * Fixed benchmark over a built-in set of positions. Searches run from an
+ * empty transposition table, stop on depth or nodes only and draw their
+ * random choices from the given seed, so two runs of the same build give
+ * the same node count and signature and only the time differs.
+ */
+namespace Bench {
+
+int run(Search::Limits limits, unsigned seed);
+
+} // namespace Bench
@@ -0,0 +1,220 @@
+#include "book.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace DarkChess;
+
+namespace Book {
+
+namespace {
+
+const char Magic[4] = {'C', 'D', 'B', 'K'};
+const uint32_t Version = 4;
+// Moves seen fewer times than this are not trusted
+const uint32_t MinGames = 2;
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint64_t count;
+};
+
+// Results from the point of view of the side that played the move
+struct Entry {
+  uint64_t key;
+  uint32_t move;
+  uint32_t games;
+  uint32_t wins;
+  uint32_t draws;
+};
+
+static_assert(sizeof(Entry) == 24, "book entries are stored as is");
+
+const Entry* entries = nullptr;
+uint64_t count = 0;
+
+bool operator<(const Entry &a, const Entry &b) {
+  return a.key != b.key ? a.key < b.key : a.move < b.move;
+}
+
+// Sorts and merges the entries of identical key and move
+void aggregate(std::vector<Entry> &v) {
+  std::sort(v.begin(), v.end());
+  size_t n = 0;
+  for (size_t i = 0; i < v.size(); i++) {
+    if (n > 0 && v[n - 1].key == v[i].key && v[n - 1].move == v[i].move) {
+      v[n - 1].games += v[i].games;
+      v[n - 1].wins += v[i].wins;
+      v[n - 1].draws += v[i].draws;
+    } else {
+      v[n++] = v[i];
+    }
+  }
+  v.resize(n);
+}
+
+bool parse_square(const std::string &s, size_t pos, Square &sq) {
+  if (pos + 1 >= s.size()) return false;
+  int f = s[pos] - 'a', r = s[pos + 1] - '1';
+  if (f < FILE_A || f > FILE_D || r < RANK_1 || r > RANK_8) return false;
+  sq = make_square(File(f), Rank(r));
+  return true;
+}
+
+bool parse_piece(char ch, Piece &p) {
+  const char letters[] = "pcnrmgk";
+  const char* at = strchr(letters, tolower(ch));
+  if (!ch || !at) return false;
+  p = make_piece(islower(ch) ? RED : BLACK, PieceType(at - letters));
+  return true;
+}
+
+// Whether m can be played on board: a flip of a dark square or one of
+// its legal moves
+bool playable(Board &board, Move m) {
+  if (m >= MOVE_PASS) return false;
+  if (!is_move_ok(m)) return board.is_dark(from_sq(m));
+  MoveList mList;
+  ScoreList sList;
+  int size = board.get_legal_moves(mList, sList);
+  return std::find(mList.begin(), mList.begin() + size, m) != mList.begin() + size;
+}
+
+// Adds the first maxPlies plies of one record to out; a malformed or
+// illegal ply ends the game there
+void replay(Board &board, const std::string &line, int maxPlies, std::vector<Entry> &out) {
+  std::istringstream ss(line);
+  std::string result, ply;
+  ss >> result;
+  Color winner = result == "red" ? RED : (result == "black" ? BLACK : COLOR_NONE);
+  if (winner == COLOR_NONE && result != "draw") return;
+
+  board.init();
+  for (int n = 0; n < maxPlies && ss >> ply; n++) {
+    Square from, to;
+    Piece p;
+    if (!parse_square(ply, 0, from)) return;
+
+    // Moves are stored as seen on the canonical image of the board
+    int sym;
+    Entry e = {key(board, sym), 0, 1, 0, 0};
+    Color mover = board.side_to_move();
+    if (ply.size() == 4 && ply[2] == '=' && parse_piece(ply[3], p) && board.is_dark(from)) {
+      if (mover == COLOR_NONE) mover = color_of(p);
+      e.move = mirror(make_move(from, from), sym);
+      board.flip_move(make_move(from, from), p, color_of(p));
+    } else if (ply.size() == 5 && ply[2] == '-' && parse_square(ply, 3, to) && mover != COLOR_NONE
+               && playable(board, make_move(from, to))) {
+      Piece captured;
+      e.move = mirror(make_move(from, to), sym);
+      board.do_move(make_move(from, to), captured);
+    } else {
+      return;
+    }
+    e.wins = winner == mover;
+    e.draws = winner == COLOR_NONE;
+    out.push_back(e);
+  }
+}
+
+} // namespace
+
+uint64_t key(const Board &board, int &sym) {
+  uint64_t h = board.canonical_hash(sym);
+  return h ^ board.getPoolKey(sym & SYM_COLOR);
+}
+
+bool load(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  void* map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(Header)) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) return false;
+
+  const Header* h = static_cast<const Header*>(map);
+  if (memcmp(h->magic, Magic, 4) || h->version != Version
+      || uint64_t(st.st_size) != sizeof(Header) + h->count * sizeof(Entry)) {
+    munmap(map, st.st_size);
+    return false;
+  }
+  entries = reinterpret_cast<const Entry*>(h + 1);
+  count = h->count;
+  return true;
+}
+
+bool probe(const Board &board, Move &m) {
+  if (!entries) return false;
+
+  int sym;
+  Entry target = {key(board, sym), 0, 0, 0, 0};
+  const Entry* e = std::lower_bound(entries, entries + count, target);
+  // Expected score with one win and one loss added, so a move that did
+  // well once does not beat a move that did almost as well many times.
+  // A stale book or a key collision can offer moves that are not legal
+  // here, which would forfeit the game, so those are passed over.
+  Board position = board;
+  double bestScore = -1;
+  for (; e != entries + count && e->key == target.key; e++) {
+    if (e->games < MinGames) continue;
+    double score = (e->wins + 0.5 * e->draws + 1) / (e->games + 2);
+    Move candidate = mirror(Move(e->move), sym);
+    if (score > bestScore && playable(position, candidate)) {
+      bestScore = score;
+      m = candidate;
+    }
+  }
+  return bestScore >= 0;
+}
+
+long build(const std::string &records, const std::string &out, int threads, int maxPlies) {
+  std::ifstream in(records);
+  if (!in) return -1;
+  std::vector<std::string> lines;
+  for (std::string line; std::getline(in, line); ) {
+    if (!line.empty()) lines.push_back(line);
+  }
+
+  // Every thread replays and merges its own share of the games
+  std::vector<std::vector<Entry>> parts(threads);
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; t++) {
+    pool.emplace_back([&, t]() {
+      Board board;
+      for (size_t i = t; i < lines.size(); i += threads) {
+        replay(board, lines[i], maxPlies, parts[t]);
+      }
+      aggregate(parts[t]);
+    });
+  }
+  for (auto &t : pool) t.join();
+
+  std::vector<Entry> all;
+  for (auto &p : parts) all.insert(all.end(), p.begin(), p.end());
+  aggregate(all);
+
+  std::string tmp = out + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (!f) return -1;
+  Header h;
+  memcpy(h.magic, Magic, 4);
+  h.version = Version;
+  h.count = all.size();
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+         && fwrite(all.data(), sizeof(Entry), all.size(), f) == all.size();
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), out.c_str()) != 0) return -1;
+  return all.size();
+}
+
+} // namespace Book
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+
+#include "state.h"
+
+/*
+ * Opening book for the flip-heavy first plies.
+ *
+ * Positions are keyed by the board hash combined with the pool of pieces
+ * still hidden, so two boards that look alike but hide different pieces
+ * are kept apart. Both are taken on the canonical mirror image of the
+ * board, so mirrored and colour-swapped openings share their entries.
+ * The book file is a header followed by fixed-size entries sorted by key
+ * and move; it is memory-mapped and searched in place, so loading and
+ * probing cost nothing beyond the pages touched.
+ *
+ * Books are built from game records, one game per line:
+ *   <red|black|draw> <ply> <ply> ...
+ * where a flip is written "a1=k" (the revealed piece, black in capitals)
+ * and a move "a1-a2". cdc_match --records writes this format.
+ */
+namespace Book {
+
+// Book key of the position on the board; sym is the symmetry that maps
+// the board onto the image the key describes
+uint64_t key(const DarkChess::Board &board, int &sym);
+
+// Maps a book file; false if it is missing or damaged
+bool load(const std::string &path);
+
+// Best scoring book move for the position, if it has been played enough
+bool probe(const DarkChess::Board &board, DarkChess::Move &m);
+
+// Replays the first maxPlies plies of every game in records on the given
+// number of threads and writes the aggregated book to out. Returns the
+// number of entries written, or -1 on an I/O error.
+long build(const std::string &records, const std::string &out, int threads, int maxPlies = 24);
+
+} // namespace Book
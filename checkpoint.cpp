@@ -0,0 +1,70 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+using namespace DarkChess;
+
+namespace Checkpoint {
+
+namespace {
+
+const char Magic[4] = {'C', 'D', 'C', 'P'};
+const uint32_t Version = 1;
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint32_t entries;
+  uint32_t reserved;
+};
+
+} // namespace
+
+bool save(const std::string &path, const Board &board, const Entries &entries) {
+  std::string tmp = path + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (!f) return false;
+  Header h;
+  memcpy(h.magic, Magic, 4);
+  h.version = Version;
+  h.entries = entries.size();
+  h.reserved = 0;
+  Snapshot snap = board.snapshot();
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+         && fwrite(&snap, sizeof(snap), 1, f) == 1
+         && fwrite(entries.data(), sizeof(Entries::value_type), entries.size(), f) == entries.size();
+  // The data must be on disk before the rename can replace the old file
+  ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+  ok = fclose(f) == 0 && ok;
+  return ok && rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool load(const std::string &path, Board &board, Trans::TranspTable &tt) {
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f) return false;
+  Header h;
+  Snapshot snap;
+  Entries entries;
+  bool ok = fread(&h, sizeof(h), 1, f) == 1 && !memcmp(h.magic, Magic, 4) && h.version == Version
+         && h.entries <= MaxEntries && fread(&snap, sizeof(snap), 1, f) == 1;
+  if (ok) {
+    entries.resize(h.entries);
+    ok = fread(entries.data(), sizeof(Entries::value_type), entries.size(), f) == entries.size();
+  }
+  fclose(f);
+  if (!ok) return false;
+
+  Board restored;
+  try {
+    restored.restore(snap);
+  } catch (const std::invalid_argument &) {
+    return false;
+  }
+  board = restored;
+  tt.load(entries.data(), entries.size());
+  return true;
+}
+
+} // namespace Checkpoint
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "state.h"
+#include "tt.h"
+
+/*
+ * Game state saved after every move, so a replacement process can pick
+ * the game up where a crashed one left it.
+ *
+ * A checkpoint file holds a small header, the board's Snapshot and the
+ * transposition table entries of the engine's last search nearest its
+ * root, so the new process starts with the part of the table it would
+ * use first. Saving writes a temporary file, syncs it and renames it over
+ * the old one, so even after a crash a reader sees either the previous
+ * checkpoint or the new one, never a partial file.
+ */
+namespace Checkpoint {
+
+typedef std::vector<Trans::TranspTable::Saved> Entries;
+
+// Most TT entries kept with a checkpoint
+const size_t MaxEntries = 1 << 14;
+
+bool save(const std::string &path, const DarkChess::Board &board, const Entries &entries);
+
+// Restores the board and loads the entries into tt; false if the file is
+// missing or damaged, which leaves both untouched
+bool load(const std::string &path, DarkChess::Board &board, Trans::TranspTable &tt);
+
+} // namespace Checkpoint
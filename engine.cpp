@@ -1,9 +1,77 @@
 #include "engine.h"
 
+#include <algorithm>
+
+// function pointer array
+static bool (Engine::*functions[])(const char* [], char*) = {
+  &Engine::protocol_version,
+  &Engine::name,
+  &Engine::version,
+  &Engine::known_command,
+  &Engine::list_commands,
+  &Engine::quit,
+  &Engine::boardsize,
+  &Engine::reset_board,
+  &Engine::num_repetition,
+  &Engine::num_moves_to_draw,
+  &Engine::move,
+  &Engine::flip,
+  &Engine::genmove,
+  &Engine::game_over,
+  &Engine::ready,
+  &Engine::time_settings,
+  &Engine::time_left,
+  &Engine::showboard,
+  &Engine::setoption
+};
+
 Engine::Engine() {}
 
 Engine::~Engine() {}
 
+int Engine::execute(char* read, char* output) {
+  char write[1024], *token, *save;
+  const char *data[10] = {NULL};
+  int id = -1;
+  bool isFailed;
+
+  // get command id
+  token = strtok_r(read, " ", &save);
+  if (token == NULL || sscanf(token, "%d", &id) != 1) {
+    sprintf(output, "?\n");
+    return id;
+  }
+  // get command name
+  token = strtok_r(NULL, " ", &save);
+  // get command data
+  int i = 0;
+  while (i < 10 && (token = strtok_r(NULL, " ", &save)) != NULL) {
+    data[i++] = token;
+  }
+  write[0] = '\0'; // empty the char array
+
+  if (id < 0 || id >= COMMAND_NUM) {
+    sprintf(output, "?%d unknown command\n", id);
+    return id;
+  }
+  isFailed = (this->*functions[id])(data, write);
+
+  if (strlen(write) > 0) {
+    if (isFailed) {
+      sprintf(output, "?%d %s\n", id, write);
+    } else {
+      sprintf(output, "=%d %s\n", id, write);
+    }
+  } else {
+    if (isFailed) {
+      sprintf(output, "?%d\n", id);
+    } else {
+      sprintf(output, "=%d\n", id);
+    }
+  }
+  return id;
+}
+
 bool Engine::protocol_version(const char* data[], char* response) {
   strcpy(response, "1.0.0");
   return 0;
@@ -20,6 +88,10 @@ bool Engine::version(const char* data[], char* response) {
 }
 
 bool Engine::known_command(const char* data[], char* response) {
+  if (data[0] == NULL) {
+    strcpy(response, "usage: known_command name");
+    return 1;
+  }
   for (int i = 0; i < COMMAND_NUM; i++) {
     if (!strcmp(data[0], commands_name[i])) {
       strcpy(response, "true");
@@ -52,6 +124,8 @@ bool Engine::boardsize(const char* data[], char* response) {
 
 bool Engine::reset_board(const char* data[], char* response) {
   board.init();
+  hotEntries.clear();
+  save_checkpoint();
   // TODO: time
   return 0;
 }
@@ -65,53 +139,106 @@ bool Engine::num_moves_to_draw(const char* data[], char* response) {
 }
 
 bool Engine::move(const char* data[], char* response) {
-  Square s1 = toSquare(data[0]);
-  Square s2 = toSquare(data[1]);
+  Square s1, s2;
+  if (!parse_square(data[0], s1) || !parse_square(data[1], s2)) {
+    strcpy(response, "usage: move from to");
+    return 1;
+  }
   Move m = make_move(s1, s2);
+  // A bad move from one game must not take down a server playing others
+  MoveList mList;
+  ScoreList sList;
+  int size = board.get_legal_moves(mList, sList);
+  if (std::find(mList.begin(), mList.begin() + size, m) == mList.begin() + size) {
+    strcpy(response, "illegal move");
+    return 1;
+  }
   Piece captured;
   board.do_move(m, captured);
-  std::cout << board.print_board() << std::endl;
+  save_checkpoint();
+  if (verbose) std::cout << board.print_board() << std::endl;
   return 0;
 }
 
 bool Engine::flip(const char* data[], char* response) {
   Color c;
+  Square s;
+  if (!parse_square(data[0], s) || data[1] == NULL || strToPieceType(tolower(data[1][0])) == EMPTY) {
+    strcpy(response, "usage: flip square piece");
+    return 1;
+  }
+  if (!board.is_dark(s)) {
+    strcpy(response, "illegal flip");
+    return 1;
+  }
   Piece p = toPiece(data[1], c);
-  Square s = toSquare(data[0]);
   Move m = make_move(s, s);
   board.flip_move(m, p, c);
-  std::cout << board.print_board() << std::endl;
+  save_checkpoint();
+  if (verbose) std::cout << board.print_board() << std::endl;
   return 0;
 }
 
 bool Engine::genmove(const char* data[], char* response) {
   Move m;
+  // Book moves cost no clock, the time goes to the middlegame
+  if (Book::probe(board, m)) {
+    strcpy(response, board.print_move(m).c_str());
+    if (verbose) std::cout << board.print_board() << std::endl;
+    return 0;
+  }
   //if (board.genmove(m)) {
-  Search::iterDeep(board);
-  if (Search::_bestMove != MOVE_NULL) {
-    m = Search::_bestMove;
+  if (mode == MCTS) {
+    Mcts::search(ctx, board, mctsTable, arenas, mctsNodes);
+  } else if (mode == PIMC) {
+    Search::pimc(ctx, board, pimcSamples, arenas.size());
+  } else {
+    Search::iterDeep(ctx, board);
+  }
+  if (!checkpoint.empty()) {
+    hotEntries.resize(Checkpoint::MaxEntries);
+    hotEntries.resize(Search::hot_entries(ctx, board, hotEntries.data(), hotEntries.size()));
+  }
+  if (ctx.bestMove != MOVE_NULL) {
+    m = ctx.bestMove;
     strcpy(response, board.print_move(m).c_str());
   } else {
     strcpy(response, "no legal moves");
   }
-  std::cout << board.print_board() << std::endl;
+  if (deterministic) {
+    fprintf(stderr, "nodes %llu signature %016llx\n",
+            (unsigned long long)ctx.nodes, (unsigned long long)ctx.signature);
+  }
+  if (verbose) std::cout << board.print_board() << std::endl;
   return 0;
 }
 
+bool Engine::set_checkpoint(const std::string &path) {
+  checkpoint = path;
+  return Checkpoint::load(path, board, Search::tt);
+}
+
+void Engine::save_checkpoint() {
+  if (checkpoint.empty()) return;
+  if (!Checkpoint::save(checkpoint, board, hotEntries)) {
+    fprintf(stderr, "cannot write checkpoint %s\n", checkpoint.c_str());
+  }
+}
+
 bool Engine::searchMove(Move &m) {
-  Search::iterDeep(board);
+  Search::iterDeep(ctx, board);
   MoveList mList;
-  if (Search::_bestMove == MOVE_NULL || Search::_bestScore < Search::MIN_SCORE) {
-    std::cout << "bestMove = NULL or bestScore < 100 " << Search::_bestScore << std::endl;
+  if (ctx.bestMove == MOVE_NULL || ctx.bestScore < Search::MIN_SCORE) {
+    std::cout << "bestMove = NULL or bestScore < 100 " << ctx.bestScore << std::endl;
     int size = board.legal_flip_actions(mList, 0);
 
     if (size == 0) return false;
 
     //std::uniform_int_distribution<size_t> distr(0, size - 1);
     //size_t i = distr(board.getRng());
-    m = mList[rand() % size];
+    m = mList[ctx.rng() % size];
   } else {
-    m = Search::_bestMove;
+    m = ctx.bestMove;
   }
   return true;
 }
@@ -140,6 +267,60 @@ bool Engine::time_left(const char* data[], char* response) {
 }
 
 bool Engine::showboard(const char* data[], char* response) {
-  std::cout << board.print_board() << std::endl;
+  if (verbose) std::cout << board.print_board() << std::endl;
+  return 0;
+}
+void Engine::set_deterministic(bool on) {
+  deterministic = on;
+  if (on) {
+    ctx.limits.time = 0;
+    if (ctx.limits.nodes == 0 && ctx.limits.depth == 0) {
+      ctx.limits.nodes = 1000000;
+    }
+  }
+}
+
+// setoption <name> <value>
+bool Engine::setoption(const char* data[], char* response) {
+  if (data[0] == NULL || data[1] == NULL) {
+    strcpy(response, "usage: setoption name value");
+    return 1;
+  }
+  if (!strcmp(data[0], "seed")) {
+    set_seed(strtoul(data[1], NULL, 10));
+  } else if (!strcmp(data[0], "nodes")) {
+    ctx.limits.nodes = strtoull(data[1], NULL, 10);
+  } else if (!strcmp(data[0], "depth")) {
+    ctx.limits.depth = atoi(data[1]);
+  } else if (!strcmp(data[0], "movetime")) {
+    ctx.limits.time = atof(data[1]);
+  } else if (!strcmp(data[0], "deterministic")) {
+    set_deterministic(atoi(data[1]) != 0);
+  } else if (!strcmp(data[0], "search")) {
+    if (!strcmp(data[1], "alphabeta")) {
+      mode = ALPHABETA;
+    } else if (!strcmp(data[1], "mcts")) {
+      mode = MCTS;
+    } else if (!strcmp(data[1], "pimc")) {
+      mode = PIMC;
+    } else {
+      sprintf(response, "unknown search %s", data[1]);
+      return 1;
+    }
+  } else if (!strcmp(data[0], "mctsnodes")) {
+    mctsNodes = std::max(1ULL, strtoull(data[1], NULL, 10));
+    set_threads(arenas.size());
+  } else if (!strcmp(data[0], "multipv")) {
+    set_analysis(atoi(data[1]), ctx.info != nullptr);
+  } else if (!strcmp(data[0], "info")) {
+    set_analysis(ctx.multiPV, atoi(data[1]) != 0);
+  } else if (!strcmp(data[0], "pimcsamples")) {
+    pimcSamples = std::max(1, atoi(data[1]));
+  } else if (!strcmp(data[0], "threads")) {
+    set_threads(atoi(data[1]));
+  } else {
+    sprintf(response, "unknown option %s", data[0]);
+    return 1;
+  }
   return 0;
 }
\ No newline at end of file
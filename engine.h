@@ -10,10 +10,36 @@
 #include "types.h"
 #include "state.h"
 #include "search.h"
+#include "book.h"
+#include "mcts.h"
+#include "checkpoint.h"
 
 using namespace DarkChess;
 
-#define COMMAND_NUM 18
+#define COMMAND_NUM 19
+
+// commands enumerate
+enum COMMANDS{
+  PROTOCOL_VERSION = 0, // 0
+  NAME, // 1
+  VERSION, // 2
+  KNOWN_COMMAND, // 3
+  LIST_COMMANDS, // 4
+  QUIT, // 5
+  BOARDSIZE, // 6
+  RESET_BOARD, // 7
+  NUM_REPETITION, // 8
+  NUM_MOVES_TO_DRAW, // 9
+  MOVE, // 10
+  FLIP, // 11
+  GENMOVE, // 12
+  GAME_OVER, // 13
+  READY, // 14
+  TIME_SETTINGS, // 15
+  TIME_LEFT, // 16
+  SHOWBOARD, // 17
+  SETOPTION // 18
+};
 
 class Engine {
   const char* commands_name[COMMAND_NUM] = {
@@ -34,7 +60,8 @@ class Engine {
 		"ready",
 		"time_settings",
 		"time_left",
-  	"showboard"
+  	"showboard",
+		"setoption"
 	};
 
   public:
@@ -59,11 +86,47 @@ class Engine {
     bool time_settings(const char* data[], char* response);// 15
     bool time_left(const char* data[], char* response);// 16
     bool showboard(const char* data[], char* response);// 17
+    bool setoption(const char* data[], char* response);// 18
   
     bool searchMove(Move &m);
 
+    // Parses "id command args" in place, runs it and writes the framed
+    // reply ("=id ..." or "?id ...") to output. Returns the command id.
+    int execute(char* read, char* output);
+    // Board dumps on stdout are only wanted when a single game owns it
+    void set_verbose(bool v) { verbose = v; }
+    void set_limits(const Search::Limits &limits) { ctx.limits = limits; }
+    void set_seed(unsigned seed) { ctx.rng.seed(seed); }
+    // Searches stop on nodes only and report their node signature
+    void set_deterministic(bool on);
+    // Root lines searched exactly, and whether each iteration reports
+    // them on stderr
+    void set_analysis(int multiPV, bool info) {
+      ctx.multiPV = std::max(1, multiPV);
+      ctx.info = info ? stderr : nullptr;
+    }
+    enum SearchMode { ALPHABETA, MCTS, PIMC };
+    void set_search(SearchMode m) { mode = m; }
+    // Threads of an MCTS or PIMC search
+    void set_threads(int n) { arenas = std::vector<Mcts::Arena>(std::max(1, n)); }
+    // Saves the game to path after every move and resumes the one saved
+    // there, if any; returns whether a game was resumed
+    bool set_checkpoint(const std::string &path);
+
   private:
     Board board;
+    Search::Context ctx;
+    bool verbose = true;
+    bool deterministic = false;
+    SearchMode mode = ALPHABETA;
+    std::vector<Mcts::Arena> arenas = std::vector<Mcts::Arena>(1); // one per MCTS thread
+    Mcts::Table mctsTable;
+    size_t mctsNodes = Mcts::DEFAULT_NODES;
+    int pimcSamples = 16; // determinizations per PIMC search
+    std::string checkpoint;
+    Checkpoint::Entries hotEntries; // TT entries nearest the root of our last search, saved with the game
+
+    void save_checkpoint();
     
     PieceType strToPieceType(const char in) {
       switch (in) {
@@ -84,6 +147,15 @@ class Engine {
       return make_square(f, r); // File f, Rank r
     }
 
+    // Square named by in, like "a1"; false for anything else
+    bool parse_square(const char* in, Square &s) {
+      if (in == NULL || tolower(in[0]) < 'a' || tolower(in[0]) > 'd' || in[1] < '1' || in[1] > '8' || in[2]) {
+        return false;
+      }
+      s = toSquare(in);
+      return true;
+    }
+
     Piece toPiece(const char* in, Color &c) {
       c = islower(in[0]) ? RED : BLACK;
       PieceType pt = strToPieceType(tolower(in[0]));
@@ -0,0 +1,22 @@
+#pragma once
+
+// Generated by cdc1 --tune; rerun the tuner rather than editing by hand.
+// Material values and the basic value multipliers of update_basic_value.
+
+namespace DarkChess {
+namespace EvalParams {
+
+const int PawnValue = 10;
+const int CannonValue = 200;
+const int KnightValue = 50;
+const int RookValue = 75;
+const int MinisterValue = 100;
+const int GuardValue = 260;
+const int KingValue = 320;
+const int BonusCapture = 10;
+const int BvBase = 1;
+const int BvPrey = 4;
+const int BvPeer = 1;
+
+} // namespace EvalParams
+} // namespace DarkChess
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "types.h"
+#include "memory.h"
+
+namespace DarkChess {
+
+/*
+ * Evaluation hash table consulted by Board::evaluate.
+ *
+ * Scores are stored from red's point of view, so both sides to move share
+ * an entry. Each slot packs the upper half of the key and the score into a
+ * single 64-bit word, which keeps the table lock-free: a reader sees either
+ * a whole entry or one that fails the key check.
+ */
+class EvalCache {
+  public:
+    struct Stats {
+      uint64_t probes = 0;
+      uint64_t hits = 0;
+    };
+
+    EvalCache(size_t entries = 1 << 18) { resize(entries); }
+
+    void resize(size_t entries) {
+      size_t count = 1;
+      while (count * 2 <= entries) count *= 2;
+      table.reset();
+      table = Memory::make_array<std::atomic<uint64_t>>(count);
+      mask = count - 1;
+    }
+
+    void clear() {
+      for (uint64_t i = 0; i <= mask; i++) {
+        table[i].store(0, std::memory_order_relaxed);
+      }
+    }
+
+    bool probe(uint64_t key, int &score) const {
+      uint64_t slot = table[key & mask].load(std::memory_order_relaxed);
+      stats.probes++;
+      if ((slot >> 32) != (key >> 32) || slot == 0) return false;
+      stats.hits++;
+      score = int(uint32_t(slot));
+      return true;
+    }
+
+    void store(uint64_t key, int score) {
+      uint64_t slot = (key & 0xFFFFFFFF00000000ULL) | uint32_t(score);
+      table[key & mask].store(slot, std::memory_order_relaxed);
+    }
+
+    void prefetch(uint64_t key) const {
+      __builtin_prefetch(&table[key & mask]);
+    }
+
+    // Counters of the calling thread
+    static Stats &thread_stats() { return stats; }
+
+  private:
+    static thread_local Stats stats;
+    Memory::Array<std::atomic<uint64_t>> table;
+    uint64_t mask;
+};
+
+extern EvalCache evalCache;
+
+} // namespace DarkChess
@@ -1,94 +1,176 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <thread>
 
 #include "engine.h"
+#include "server.h"
+#include "batch.h"
+#include "bench.h"
+#include "training.h"
+#include "tuner.h"
 
 using namespace DarkChess;
 
-// commands enumerate
-enum COMMANDS{
-  PROTOCOL_VERSION = 0, // 0
-  NAME, // 1
-  VERSION, // 2
-  KNOWN_COMMAND, // 3
-  LIST_COMMANDS, // 4
-  QUIT, // 5
-  BOARDSIZE, // 6
-  RESET_BOARD, // 7
-  NUM_REPETITION, // 8
-  NUM_MOVES_TO_DRAW, // 9
-  MOVE, // 10
-  FLIP, // 11
-  GENMOVE, // 12
-  GAME_OVER, // 13
-  READY, // 14
-  TIME_SETTINGS, // 15
-  TIME_LEFT, // 16
-  SHOWBOARD // 17
-};
+int main(int argc, char* argv[]) {
+  char read[1024], output[1024];
+  int id;
+  bool server = false;
+  bool bench = false;
+  bool deterministic = false;
+  Engine::SearchMode mode = Engine::ALPHABETA;
+  unsigned seed = 1;
+  int multiPV = 1;
+  bool info = false;
+  const char* batch = NULL;
+  const char* tbgen = NULL;
+  int tbgenPieces = 0;
+  const char* bookgen[2] = {NULL, NULL};
+  const char* selfplay = NULL;
+  uint64_t selfplayPositions = 0;
+  const char* tune[2] = {NULL, NULL};
+  const char* checkpoint = NULL;
+  size_t hashMb = 0;
+  bool prefault = false;
+  const char* shm = NULL;
+  Search::Limits limits;
+  int threads = std::max(1u, std::thread::hardware_concurrency());
 
-// function pointer array
-static bool (Engine::*functions[])(const char* [], char*) = {
-  &Engine::protocol_version,
-  &Engine::name,
-  &Engine::version,
-  &Engine::known_command,
-  &Engine::list_commands,
-  &Engine::quit,
-  &Engine::boardsize,
-  &Engine::reset_board,
-  &Engine::num_repetition,
-  &Engine::num_moves_to_draw,
-  &Engine::move,
-  &Engine::flip,
-  &Engine::genmove,
-  &Engine::game_over,
-  &Engine::ready,
-  &Engine::time_settings,
-  &Engine::time_left,
-  &Engine::showboard
-};
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--server")) {
+      server = true;
+    } else if (!strcmp(argv[i], "--bench")) {
+      bench = true;
+    } else if (!strcmp(argv[i], "--deterministic")) {
+      deterministic = true;
+    } else if (!strcmp(argv[i], "--mcts")) {
+      mode = Engine::MCTS;
+    } else if (!strcmp(argv[i], "--pimc")) {
+      mode = Engine::PIMC;
+    } else if (!strcmp(argv[i], "--multipv") && i + 1 < argc) {
+      multiPV = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--info")) {
+      info = true;
+    } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+      seed = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "--batch") && i + 1 < argc) {
+      batch = argv[++i];
+    } else if (!strcmp(argv[i], "--depth") && i + 1 < argc) {
+      limits.depth = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--nodes") && i + 1 < argc) {
+      limits.nodes = strtoull(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "--movetime") && i + 1 < argc) {
+      limits.time = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+      threads = std::max(1, atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "--tb") && i + 1 < argc) {
+      int n = Tablebase::load(argv[++i]);
+      fprintf(stderr, "loaded %d tablebases up to %d pieces\n", n, Tablebase::max_pieces());
+    } else if (!strcmp(argv[i], "--tbgen") && i + 2 < argc) {
+      tbgen = argv[++i];
+      tbgenPieces = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--nnue") && i + 1 < argc) {
+      if (!Nnue::load(argv[++i])) {
+        fprintf(stderr, "cannot load network %s\n", argv[i]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--book") && i + 1 < argc) {
+      if (!Book::load(argv[++i])) {
+        fprintf(stderr, "cannot load book %s\n", argv[i]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "--bookgen") && i + 2 < argc) {
+      bookgen[0] = argv[++i];
+      bookgen[1] = argv[++i];
+    } else if (!strcmp(argv[i], "--selfplay") && i + 2 < argc) {
+      selfplay = argv[++i];
+      selfplayPositions = strtoull(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "--tune") && i + 2 < argc) {
+      tune[0] = argv[++i];
+      tune[1] = argv[++i];
+    } else if (!strcmp(argv[i], "--checkpoint") && i + 1 < argc) {
+      checkpoint = argv[++i];
+    } else if (!strcmp(argv[i], "--symmetry")) {
+      symmetricHashing = true;
+    } else if (!strcmp(argv[i], "--hash") && i + 1 < argc) {
+      hashMb = std::max(1, atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "--shm") && i + 1 < argc) {
+      shm = argv[++i];
+    } else if (!strcmp(argv[i], "--prefault")) {
+      prefault = true;
+    } else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  // The table is sized once the thread count is known, so it can be
+  // faulted in by all of them
+  if (prefault) Memory::set_prefault(threads);
+  if (shm) {
+    if (!Search::tt.share(shm, hashMb ? hashMb : Trans::TranspTable::DEFAULT_MB)) {
+      fprintf(stderr, "cannot share the hash table as %s\n", shm);
+      return 1;
+    }
+  } else if (hashMb || prefault) {
+    Search::tt.resize(hashMb ? hashMb : Trans::TranspTable::DEFAULT_MB);
+  }
+
+  if (bookgen[0]) {
+    long n = Book::build(bookgen[0], bookgen[1], threads);
+    if (n < 0) {
+      fprintf(stderr, "cannot build book from %s\n", bookgen[0]);
+      return 1;
+    }
+    fprintf(stderr, "wrote %ld book entries\n", n);
+    return 0;
+  }
+  if (selfplay) {
+    if (!Training::generate(selfplay, selfplayPositions, threads, limits, seed)) {
+      fprintf(stderr, "cannot write %s\n", selfplay);
+      return 1;
+    }
+    return 0;
+  }
+  if (tune[0]) {
+    if (!Tuner::run(tune[0], tune[1], threads)) {
+      fprintf(stderr, "cannot tune on %s\n", tune[0]);
+      return 1;
+    }
+    return 0;
+  }
+  if (tbgen) {
+    return Tablebase::generate(tbgen, tbgenPieces, threads) ? 0 : 1;
+  }
+  if (bench) {
+    return Bench::run(limits, seed);
+  }
+  if (batch) {
+    return Batch::run(batch, limits, threads);
+  }
+  if (server) {
+    return Server::run(threads, limits);
+  }
 
-int main() {
-  char read[1024], write[1024], output[1024], *token;
-  const char *data[10];
-  int id;
-  bool isFailed;
   Engine engine;
+  engine.set_limits(limits);
+  engine.set_seed(seed);
+  engine.set_deterministic(deterministic);
+  engine.set_search(mode);
+  engine.set_analysis(multiPV, info);
+  engine.set_threads(threads);
+  if (checkpoint && engine.set_checkpoint(checkpoint)) {
+    fprintf(stderr, "resumed game from %s\n", checkpoint);
+  }
 
   do {
     // read command
-    fgets(read, 1024, stdin);
+    if (fgets(read, 1024, stdin) == NULL) break;
     fprintf(stderr, "%s", read);
     // remove newline (\n)
-    read[strlen(read) - 1] = '\0';
-    // get command id
-    token = strtok(read, " ");
-    sscanf(token, "%d", &id);
-    // get command name
-    token = strtok(NULL, " ");
-    // get command data
-    int i = 0;
-    while ((token = strtok(NULL, " ")) != NULL) {
-      data[i++] = token;
-    }
-    write[0] = '\0'; // empty the char array
-
-    isFailed = (engine.*functions[id])(data, write);
+    read[strcspn(read, "\n")] = '\0';
 
-    if (strlen(write) > 0) {
-      if (isFailed) {
-        sprintf(output, "?%d %s\n", id, write);
-      } else {
-        sprintf(output, "=%d %s\n", id, write);
-      }
-    } else {
-      if (isFailed) {
-        sprintf(output, "?%d\n", id);
-      } else {
-        sprintf(output, "=%d\n", id);
-      }
-    }
+    id = engine.execute(read, output);
 
     fprintf(stdout, "%s", output);
     fprintf(stderr, "%s", output);
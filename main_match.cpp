@@ -0,0 +1,60 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "match.h"
+
+static void usage() {
+  fprintf(stderr,
+    "usage: cdc_match --engine1 CMD --engine2 CMD [options]\n"
+    "  --games N          games to play (default 100)\n"
+    "  --concurrency N    games played at once (default 1)\n"
+    "  --seed S           seed of the first deal (default 1)\n"
+    "  --time T           seconds on each clock (default 900)\n"
+    "  --maxplies N       draw after N plies (default 1000)\n"
+    "  --sprt E0 E1 A B   stop once H0: elo=E0 or H1: elo=E1 is accepted\n"
+    "  --records FILE     append every game to FILE, for cdc1 --bookgen\n");
+}
+
+int main(int argc, char* argv[]) {
+  Match::Options opt;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--engine1") && i + 1 < argc) {
+      opt.engine[0] = argv[++i];
+    } else if (!strcmp(argv[i], "--engine2") && i + 1 < argc) {
+      opt.engine[1] = argv[++i];
+    } else if (!strcmp(argv[i], "--games") && i + 1 < argc) {
+      opt.games = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--concurrency") && i + 1 < argc) {
+      opt.concurrency = std::max(1, atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+      opt.seed = strtoull(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "--time") && i + 1 < argc) {
+      opt.settings.time = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--maxplies") && i + 1 < argc) {
+      opt.settings.maxPlies = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--records") && i + 1 < argc) {
+      opt.records = argv[++i];
+    } else if (!strcmp(argv[i], "--sprt") && i + 4 < argc) {
+      opt.sprt = true;
+      opt.elo0 = atof(argv[++i]);
+      opt.elo1 = atof(argv[++i]);
+      opt.alpha = atof(argv[++i]);
+      opt.beta = atof(argv[++i]);
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  if (opt.engine[0].empty() || opt.engine[1].empty()) {
+    usage();
+    return 1;
+  }
+
+  // A dying engine must not take the runner down with it
+  signal(SIGPIPE, SIG_IGN);
+  return Match::run(opt);
+}
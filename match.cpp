@@ -0,0 +1,133 @@
+#include "match.h"
+
+#include <cmath>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Match {
+
+static double score_to_elo(double s) {
+  s = std::min(std::max(s, 1e-6), 1 - 1e-6);
+  return -400 * std::log10(1 / s - 1);
+}
+
+static double elo_to_score(double elo) {
+  return 1 / (1 + std::pow(10, -elo / 400));
+}
+
+double Stats::score() const {
+  return games() ? (wins + 0.5 * draws) / games() : 0.5;
+}
+
+// Per-game variance of the score, from the observed win/draw/loss rates
+static double variance(const Stats &st) {
+  double n = st.games(), mu = st.score();
+  return (st.wins * (1 - mu) * (1 - mu) + st.draws * (0.5 - mu) * (0.5 - mu)
+        + st.losses * mu * mu) / n;
+}
+
+double Stats::elo(double &error) const {
+  double mu = score();
+  error = 0;
+  if (games() < 2) return score_to_elo(mu);
+  double dev = 1.96 * std::sqrt(variance(*this) / games());
+  error = (score_to_elo(mu + dev) - score_to_elo(mu - dev)) / 2;
+  return score_to_elo(mu);
+}
+
+double Stats::llr(double elo0, double elo1) const {
+  double var = games() ? variance(*this) : 0;
+  if (var <= 0) return 0;
+  double s0 = elo_to_score(elo0), s1 = elo_to_score(elo1);
+  return games() * (s1 - s0) * (2 * score() - s0 - s1) / (2 * var);
+}
+
+namespace {
+
+std::mutex mtx;
+int nextGame = 0;
+bool stop = false;
+Stats stats;
+FILE* records = nullptr;
+
+void report(const Options &opt, int game, const Referee::GameResult &r, int first) {
+  const char* outcome = r.winner < 0 ? "draw" : (r.winner == first ? "engine1 wins" : "engine2 wins");
+  double err, elo = stats.elo(err);
+  printf("game %d: %s (%s, %d plies) | +%d -%d =%d  elo %.1f +/- %.1f",
+         game + 1, outcome, r.reason.c_str(), r.plies,
+         stats.wins, stats.losses, stats.draws, elo, err);
+  if (opt.sprt) {
+    printf("  llr %.2f", stats.llr(opt.elo0, opt.elo1));
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+void worker(const Options &opt) {
+  Referee::EngineProcess e1(opt.engine[0]), e2(opt.engine[1]);
+  double lower = std::log(opt.beta / (1 - opt.alpha));
+  double upper = std::log((1 - opt.beta) / opt.alpha);
+
+  for (;;) {
+    int game;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (stop || nextGame >= opt.games) return;
+      game = nextGame++;
+    }
+
+    // Both games of a pair share the deal, engine1 moves first in the even one
+    int first = game % 2;
+    Referee::EngineProcess* engines[2] = {first ? &e2 : &e1, first ? &e1 : &e2};
+    Referee::GameResult r = Referee::play(engines, opt.seed + game / 2, opt.settings);
+    // Make the winner index relative to engine1
+    int winner = r.winner < 0 ? -1 : (r.winner ^ first);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    if (winner == 0) stats.wins++;
+    else if (winner == 1) stats.losses++;
+    else stats.draws++;
+    report(opt, game, r, first);
+    if (records && !r.record.empty()) {
+      fprintf(records, "%s\n", r.record.c_str());
+      fflush(records);
+    }
+
+    if (opt.sprt && !stop) {
+      double llr = stats.llr(opt.elo0, opt.elo1);
+      if (llr >= upper || llr <= lower) {
+        printf("SPRT: %s accepted (llr %.2f, bounds [%.2f, %.2f])\n",
+               llr >= upper ? "H1" : "H0", llr, lower, upper);
+        stop = true;
+      }
+    }
+  }
+}
+
+} // namespace
+
+int run(const Options &options) {
+  if (!options.records.empty()) {
+    records = fopen(options.records.c_str(), "a");
+    if (!records) {
+      fprintf(stderr, "cannot open %s\n", options.records.c_str());
+      return 1;
+    }
+  }
+
+  std::vector<std::thread> pool;
+  for (int i = 0; i < options.concurrency; i++) {
+    pool.emplace_back(worker, std::cref(options));
+  }
+  for (auto &t : pool) t.join();
+
+  double err, elo = stats.elo(err);
+  if (records) fclose(records);
+
+  printf("Finished %d games: +%d -%d =%d  score %.3f  elo %.1f +/- %.1f\n",
+         stats.games(), stats.wins, stats.losses, stats.draws, stats.score(), elo, err);
+  return 0;
+}
+
+} // namespace Match
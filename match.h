@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+
+#include "referee.h"
+
+/*
+ * Match runner: plays many games between two engine command lines in
+ * parallel, each worker driving its own pair of engine processes.
+ *
+ * Games come in pairs on the same deal with the first mover swapped.
+ * Results are reported as Elo with a 95% interval and, if enabled, as
+ * a sequential probability ratio test that can stop the match early.
+ */
+namespace Match {
+
+struct Options {
+  std::string engine[2];
+  int games = 100;
+  int concurrency = 1;
+  uint64_t seed = 1;
+  Referee::Settings settings;
+  std::string records; // file the game records are appended to, if any
+
+  bool sprt = false;
+  double elo0 = 0, elo1 = 5;
+  double alpha = 0.05, beta = 0.05;
+};
+
+// Wins, losses and draws from the first engine's point of view
+struct Stats {
+  int wins = 0, losses = 0, draws = 0;
+
+  int games() const { return wins + losses + draws; }
+  double score() const;
+  // Elo difference and the half width of its 95% confidence interval
+  double elo(double &error) const;
+  // Log-likelihood ratio of H1 (elo1) against H0 (elo0)
+  double llr(double elo0, double elo1) const;
+};
+
+int run(const Options &options);
+
+} // namespace Match
@@ -0,0 +1,480 @@
+#include "mcts.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+using namespace DarkChess;
+
+namespace Mcts {
+
+namespace {
+
+const double Exploration = 1.0;
+// A chance node visited n times may sample its first 1 + sqrt(n) outcomes
+const double WideningAlpha = 0.5;
+const int PlayoutPlies = 16;
+// Evaluation difference that counts as most of a win
+const double ScoreScale = 4000;
+const int MaxPath = 512;
+
+// Draws by repetition or the move counter depend on the path, not on the
+// position, so they are checked on every visit
+bool drawn(const Board &board) {
+  return board.getRepetition() >= 9 || board.getNoCFMoves() >= 60;
+}
+
+// Result for the side to move in [-1, 1], or false if the game goes on
+bool game_result(Board &board, int moves, double &result) {
+  if (drawn(board)) {
+    result = 0;
+    return true;
+  }
+  if (moves == 0 && board.num_of_dark_pieces() == 0) {
+    result = -1;
+    return true;
+  }
+  return false;
+}
+
+double evaluation(const Board &board) {
+  Color stm = board.side_to_move();
+  if (stm == COLOR_NONE) return 0;
+  return std::tanh(board.evaluate(stm) / ScoreScale);
+}
+
+// Draws one of the hidden pieces, each equally likely
+Piece draw_hidden(const Board &board, std::minstd_rand &rng) {
+  int total = 0;
+  for (Color c = RED; c < COLOR_NB; ++c) {
+    for (PieceType pt = PAWN; pt <= KING; ++pt) total += board.get_hidden(make_piece(c, pt));
+  }
+  int r = total ? rng() % total : 0;
+  for (Color c = RED; c < COLOR_NB; ++c) {
+    for (PieceType pt = PAWN; pt <= KING; ++pt) {
+      Piece p = make_piece(c, pt);
+      r -= board.get_hidden(p);
+      if (r < 0) return p;
+    }
+  }
+  // Counts from a FEN may not match the dark squares, reveal anything
+  return make_piece(Color(rng() % 2), PieceType(rng() % (KING + 1)));
+}
+
+// Random moves with a taste for captures, then the evaluation. The
+// result is for the side to move when the playout ends; parity tells
+// how many plies were played.
+double playout(Board &board, std::minstd_rand &rng, int &parity) {
+  MoveList mList, fList;
+  ScoreList sList;
+  double result;
+  parity = 0;
+
+  for (int ply = 0; ply < PlayoutPlies; ply++, parity ^= 1) {
+    int moves = board.get_legal_moves(mList, sList);
+    if (game_result(board, moves, result)) return result;
+    int flips = board.legal_flip_actions(fList, 0);
+
+    int best = -1;
+    for (int i = 0; i < moves; i++) {
+      if (sList[i] >= BONUS_CAPTURE && (best < 0 || sList[i] > sList[best])) best = i;
+    }
+    Piece captured;
+    if (best >= 0 && rng() % 2) {
+      board.do_move(mList[best], captured);
+      continue;
+    }
+    int r = rng() % (moves + flips);
+    if (r < moves) {
+      board.do_move(mList[r], captured);
+    } else {
+      Piece p = draw_hidden(board, rng);
+      board.flip_move(fList[r - moves], p, color_of(p));
+    }
+  }
+  return evaluation(board);
+}
+
+// Virtual loss counted for a thread on its way down
+const int64_t VirtualLoss = VALUE_UNIT;
+
+// Tries to claim node or entry for expansion; false if another thread has it
+template<typename T>
+bool claim(T* node) {
+  uint8_t expected = UNEXPANDED;
+  return node->state.compare_exchange_strong(expected, EXPANDING, std::memory_order_acquire);
+}
+
+// Table key of a position, never the 0 of a free slot
+uint64_t position_key(const Board &board) {
+  uint64_t key = board.getHash() ^ board.getPoolKey();
+  return key ? key : 1;
+}
+
+void publish(Node* node, Node* children, int n) {
+  node->children = children;
+  node->numChildren = n;
+  node->state.store(n ? EXPANDED : UNEXPANDED, std::memory_order_release);
+}
+
+// Creates the edges of a claimed position: one per move and one chance
+// node per dark square, behind a node holding them. False if the arena is
+// full or there is nothing to play.
+bool expand_decision(Entry* entry, Board &board, Arena &arena) {
+  MoveList mList, fList;
+  ScoreList sList;
+  int moves = board.get_legal_moves(mList, sList);
+  int flips = board.legal_flip_actions(fList, 0);
+  Node* node = moves + flips ? arena.alloc(1 + moves + flips) : nullptr;
+  if (!node) {
+    entry->state.store(UNEXPANDED, std::memory_order_release);
+    return false;
+  }
+  node->init(DECISION, MOVE_NULL);
+  Node* children = node + 1;
+  for (int i = 0; i < moves + flips; i++) {
+    if (i < moves) children[i].init(DECISION, mList[i]);
+    else children[i].init(CHANCE, fList[i - moves]);
+  }
+  publish(node, children, moves + flips);
+  entry->node.store(node, std::memory_order_release);
+  entry->state.store(EXPANDED, std::memory_order_release);
+  return true;
+}
+
+// Creates the possible outcomes of a claimed flip, most likely first
+bool expand_chance(Node* node, const Board &board, Arena &arena) {
+  Piece pieces[PIECE_NB];
+  int n = 0;
+  for (Color c = RED; c < COLOR_NB; ++c) {
+    for (PieceType pt = PAWN; pt <= KING; ++pt) {
+      if (board.get_hidden(make_piece(c, pt)) > 0) pieces[n++] = make_piece(c, pt);
+    }
+  }
+  std::stable_sort(pieces, pieces + n, [&](Piece a, Piece b) {
+    return board.get_hidden(a) > board.get_hidden(b);
+  });
+  Node* children = n ? arena.alloc(n) : nullptr;
+  if (!children) {
+    publish(node, nullptr, 0);
+    return false;
+  }
+  for (int i = 0; i < n; i++) {
+    children[i].init(DECISION, node->move, pieces[i], board.get_hidden(pieces[i]));
+  }
+  publish(node, children, n);
+  return true;
+}
+
+// Value of an edge: that of the position it leads to, which gathers every
+// path into it, while the position is still the one the edge last saw
+double edge_value(Node* c, uint32_t n) {
+  Entry* t = c->kind == DECISION ? c->target.load(std::memory_order_relaxed) : nullptr;
+  if (t && t->key.load(std::memory_order_relaxed) == c->key.load(std::memory_order_relaxed)) {
+    uint32_t tn = t->visits.load(std::memory_order_relaxed);
+    if (tn > 0) return double(t->value.load(std::memory_order_relaxed)) / VALUE_UNIT / tn;
+  }
+  return double(c->value.load(std::memory_order_relaxed)) / VALUE_UNIT / n;
+}
+
+// Exploration counts visits through the position, from any path
+Node* select_uct(Node* node, Entry* entry) {
+  Node* best = nullptr;
+  double bestValue = -1e9;
+  double logN = std::log(double(entry->visits.load(std::memory_order_relaxed)) + 1);
+  for (int i = 0; i < node->numChildren; i++) {
+    Node* c = &node->children[i];
+    uint32_t n = c->visits.load(std::memory_order_relaxed);
+    if (n == 0) return c;
+    double q = edge_value(c, n);
+    double v = q + Exploration * std::sqrt(logN / n);
+    if (v > bestValue) {
+      bestValue = v;
+      best = c;
+    }
+  }
+  return best;
+}
+
+// Samples an outcome by its weight among those progressive widening allows
+Node* select_outcome(Node* node, std::minstd_rand &rng) {
+  uint32_t visits = node->visits.load(std::memory_order_relaxed);
+  int open = std::min<int>(node->numChildren, 1 + int(std::pow(visits, WideningAlpha)));
+  int total = 0;
+  for (int i = 0; i < open; i++) total += node->children[i].weight;
+  int r = rng() % total;
+  for (int i = 0; i < open; i++) {
+    r -= node->children[i].weight;
+    if (r < 0) return &node->children[i];
+  }
+  return &node->children[open - 1];
+}
+
+// Everything the threads of one search share
+struct Shared {
+  Search::Context &ctx;
+  const Board &rootBoard;
+  Table &table;
+  Entry* root;
+  Node* rootNode;
+  std::atomic<uint64_t> playouts;
+  std::atomic<int> depth;
+  std::atomic<bool> stop;
+
+  Shared(Search::Context &c, const Board &b, Table &t, Entry* r, Node* rn)
+    : ctx(c), rootBoard(b), table(t), root(r), rootNode(rn), playouts(0), depth(0), stop(false) {}
+};
+
+// Edges of the position the walk stands on, expanding it if nobody has;
+// nullptr makes the position a leaf. A position without moves is never
+// expanded and is found to be over here.
+Node* edges(Entry* entry, uint64_t key, Board &board, Arena &arena, double &result, bool &ended) {
+  if (entry->state.load(std::memory_order_acquire) != EXPANDED) {
+    MoveList mList;
+    ScoreList sList;
+    if (game_result(board, board.get_legal_moves(mList, sList), result)) {
+      ended = true;
+      return nullptr;
+    }
+    // A position being expanded by another thread is a leaf for now
+    if (!claim(entry)) {
+      if (entry->state.load(std::memory_order_acquire) != EXPANDED) return nullptr;
+    } else if (entry->key.load(std::memory_order_relaxed) != key) {
+      // Replaced since it was looked up
+      entry->state.store(UNEXPANDED, std::memory_order_release);
+      return nullptr;
+    } else if (!expand_decision(entry, board, arena)) {
+      return nullptr;
+    }
+  }
+  // The entry may have been handed to another position meanwhile
+  Node* node = entry->node.load(std::memory_order_acquire);
+  if (!node || entry->key.load(std::memory_order_acquire) != key) return nullptr;
+  return node;
+}
+
+// Table entry of the position edge leads to, remembered on the edge
+Entry* follow(Shared &sh, Node* edge, uint64_t key) {
+  Entry* t = edge->target.load(std::memory_order_relaxed);
+  if (t && t->key.load(std::memory_order_acquire) == key) return t;
+  t = sh.table.find(key, sh.root);
+  edge->key.store(key, std::memory_order_relaxed);
+  edge->target.store(t, std::memory_order_relaxed);
+  return t;
+}
+
+// Checked by every worker before each playout; `own` counts the worker's
+// playouts so far, which paces its reads of the clock. The first worker
+// out of budget stops them all.
+bool out_of_budget(Shared &sh, uint64_t own) {
+  const Search::Limits &limits = sh.ctx.limits;
+  if (sh.stop.load(std::memory_order_relaxed)) return true;
+  uint64_t done = sh.playouts.load(std::memory_order_relaxed);
+  bool over = false;
+  if (limits.nodes) {
+    over = done >= limits.nodes;
+  } else if (limits.time > 0) {
+    if ((own & 63) == 0) {
+      std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - sh.ctx.start;
+      over = elapsed.count() >= limits.time;
+    }
+  } else {
+    // Without a node or time limit every root move gets one playout
+    over = done >= sh.rootNode->numChildren;
+  }
+  if (over) sh.stop.store(true, std::memory_order_relaxed);
+  return over;
+}
+
+void worker(Shared &sh, Arena &arena, std::minstd_rand &rng) {
+  Node* path[MaxPath];
+  Entry* reached[MaxPath]; // position path[i] led to, nullptr for a flip
+  int movers[MaxPath];     // parity of the player who moved into path[i]
+  uint64_t rootKey = sh.root->key.load(std::memory_order_relaxed);
+
+  for (uint64_t own = 0; !out_of_budget(sh, own); own++) {
+    // Selection and expansion, counting a virtual loss on every edge and
+    // position on the way
+    Board board = sh.rootBoard;
+    Entry* entry = sh.root;
+    uint64_t key = rootKey;
+    int n = 0, toMove = 0;
+    double result = 0;
+    bool ended = false;
+    auto visit = [&](Node* edge, Entry* to, int mover) {
+      edge->visits.fetch_add(1, std::memory_order_relaxed);
+      edge->value.fetch_sub(VirtualLoss, std::memory_order_relaxed);
+      path[n] = edge;
+      reached[n] = to;
+      movers[n++] = mover;
+    };
+    sh.root->visits.fetch_add(1, std::memory_order_relaxed);
+    while (n < MaxPath - 2) {
+      if (n > 0 && drawn(board)) {
+        ended = true;
+        break;
+      }
+      Node* node = edges(entry, key, board, arena, result, ended);
+      if (!node) break;
+
+      Node* edge = select_uct(node, entry);
+      if (edge->kind == CHANCE) {
+        // A chance node and its outcome belong to the same ply
+        visit(edge, nullptr, toMove);
+        if (edge->state.load(std::memory_order_acquire) != EXPANDED) {
+          // An outcome list being made by another thread leaves a leaf
+          if (!claim(edge)) {
+            if (edge->state.load(std::memory_order_acquire) != EXPANDED) break;
+          } else if (!expand_chance(edge, board, arena)) {
+            break;
+          }
+        }
+        edge = select_outcome(edge, rng);
+        board.flip_move(edge->move, edge->piece, color_of(edge->piece));
+      } else {
+        Piece captured;
+        board.do_move(edge->move, captured);
+      }
+      toMove ^= 1;
+
+      key = position_key(board);
+      Entry* next = follow(sh, edge, key);
+      visit(edge, next, toMove ^ 1);
+      if (!next) break;
+      bool fresh = next->visits.fetch_add(1, std::memory_order_relaxed) == 0;
+      next->value.fetch_sub(VirtualLoss, std::memory_order_relaxed);
+      entry = next;
+      // A position met for the first time is played out; one seen before,
+      // by this path or another, is searched further
+      if (fresh) break;
+    }
+
+    // Simulation, scored for the player to move at the leaf
+    int parity = 0;
+    if (!ended) result = playout(board, rng, parity);
+    int leafPlayer = toMove ^ parity;
+
+    // Backpropagation, taking the virtual losses back
+    for (int i = 0; i < n; i++) {
+      double r = movers[i] == leafPlayer ? result : -result;
+      int64_t v = int64_t(r * VALUE_UNIT) + VirtualLoss;
+      path[i]->value.fetch_add(v, std::memory_order_relaxed);
+      if (reached[i]) reached[i]->value.fetch_add(v, std::memory_order_relaxed);
+    }
+    sh.playouts.fetch_add(1, std::memory_order_relaxed);
+    int d = sh.depth.load(std::memory_order_relaxed);
+    while (d < n && !sh.depth.compare_exchange_weak(d, n, std::memory_order_relaxed)) {}
+  }
+}
+
+} // namespace
+
+void Table::resize(size_t count) {
+  size_t size = Bucket;
+  while (size < count) size <<= 1;
+  entries.reset();
+  entries = Memory::make_array<Entry>(size);
+  mask = size - 1;
+}
+
+void Table::clear() {
+  for (size_t i = 0; i <= mask; i++) {
+    Entry &e = entries[i];
+    e.key.store(0, std::memory_order_relaxed);
+    e.visits.store(0, std::memory_order_relaxed);
+    e.value.store(0, std::memory_order_relaxed);
+    e.state.store(UNEXPANDED, std::memory_order_relaxed);
+    e.node.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+Entry* Table::find(uint64_t key, const Entry* keep) {
+  Entry* bucket = &entries[key & mask & ~size_t(Bucket - 1)];
+  for (int attempt = 0; attempt < 2; attempt++) {
+    Entry* victim = nullptr;
+    for (int i = 0; i < Bucket; i++) {
+      Entry* e = &bucket[i];
+      uint64_t k = e->key.load(std::memory_order_acquire);
+      if (k == 0 && e->key.compare_exchange_strong(k, key, std::memory_order_acq_rel)) return e;
+      if (k == key) return e;
+      if (e != keep && (!victim || e->visits.load(std::memory_order_relaxed)
+                                   < victim->visits.load(std::memory_order_relaxed))) {
+        victim = e;
+      }
+    }
+    if (!victim) return nullptr;
+    // Holding the victim as if expanding it keeps every other thread from
+    // expanding it while it changes hands; threads still walking through
+    // it find the key changed and stop there
+    uint8_t state = victim->state.load(std::memory_order_relaxed);
+    if (state == EXPANDING
+        || !victim->state.compare_exchange_strong(state, EXPANDING, std::memory_order_acquire)) {
+      continue;
+    }
+    victim->node.store(nullptr, std::memory_order_relaxed);
+    victim->visits.store(0, std::memory_order_relaxed);
+    victim->value.store(0, std::memory_order_relaxed);
+    victim->key.store(key, std::memory_order_release);
+    victim->state.store(UNEXPANDED, std::memory_order_release);
+    return victim;
+  }
+  return nullptr;
+}
+
+void search(Search::Context &ctx, const Board &rootBoard, Table &table, std::vector<Arena> &arenas,
+            size_t totalNodes) {
+  if (arenas.empty()) arenas.resize(1);
+  for (auto &a : arenas) {
+    if (a.max_size() == 0) a.reserve(std::max<size_t>(totalNodes / arenas.size(), 1024));
+    a.reset();
+  }
+  // A position takes one entry and, once expanded, a node per edge; a
+  // quarter of the nodes leaves room for every position of a full arena
+  size_t positions = std::max<size_t>(totalNodes / 4, 1024);
+  if (table.size() < positions) table.resize(positions);
+  else table.clear();
+  ctx.start = std::chrono::system_clock::now();
+  ctx.nodes = 0;
+  ctx.depth = 0;
+  ctx.stopped = false;
+  ctx.bestMove = MOVE_NULL;
+  ctx.bestScore = 0;
+
+  Board board = rootBoard;
+  uint64_t key = position_key(board);
+  Entry* root = table.find(key, nullptr);
+  double result;
+  bool ended = false;
+  Node* rootNode = edges(root, key, board, arenas[0], result, ended);
+  if (!rootNode) return;
+
+  // The first thread draws from the context, so a single-threaded search
+  // stays reproducible; the others get seeds from it
+  Shared sh(ctx, rootBoard, table, root, rootNode);
+  std::vector<std::minstd_rand> rngs;
+  for (size_t i = 1; i < arenas.size(); i++) rngs.emplace_back(ctx.rng());
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < arenas.size(); i++) {
+    pool.emplace_back(worker, std::ref(sh), std::ref(arenas[i]), std::ref(rngs[i - 1]));
+  }
+  worker(sh, arenas[0], ctx.rng);
+  for (auto &t : pool) t.join();
+  ctx.nodes = sh.playouts;
+  ctx.depth = sh.depth;
+
+  Node* best = &rootNode->children[0];
+  for (int i = 1; i < rootNode->numChildren; i++) {
+    if (rootNode->children[i].visits > best->visits) best = &rootNode->children[i];
+  }
+  ctx.bestMove = best->move;
+  uint32_t visits = best->visits;
+  ctx.bestScore = visits ? int(1000 * best->value / VALUE_UNIT / visits) : 0;
+
+  ctx.totalNodes += ctx.nodes;
+  uint64_t words[2] = {ctx.nodes, uint64_t(ctx.bestMove)};
+  for (uint64_t w : words) {
+    ctx.signature = (ctx.signature ^ w) * 0x100000001B3ULL;
+  }
+}
+
+} // namespace Mcts
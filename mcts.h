@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "state.h"
+#include "search.h"
+#include "memory.h"
+
+/*
+ * Monte Carlo tree search, an alternative to Search::iterDeep that copes
+ * better with the chance introduced by flips.
+ *
+ * Decision nodes choose among moves and flips with UCT. A flip leads to a
+ * chance node whose children are the pieces that may be revealed, ordered
+ * by how many of each are still hidden; progressive widening opens more
+ * of them as the node is visited, and outcomes are sampled in proportion
+ * to the hidden counts. Playouts run a few random plies on a copy of the
+ * board and are scored with Board::evaluate.
+ *
+ * Moves transpose freely in this game, so the tree is really a graph:
+ * positions live in a Table keyed by their Zobrist hash and hidden pool,
+ * and every path into a position shares its entry, its statistics and its
+ * edges. The edges (moves, flips and flip outcomes) keep their own visit
+ * counts for exploration but take their value from the position they lead
+ * to. When a table bucket is full the least visited position in it makes
+ * room, so a long search keeps growing in a fixed amount of memory.
+ *
+ * Several threads grow one shared tree. Statistics are atomic counters;
+ * a thread passing through a node counts a provisional loss there
+ * (virtual loss) until its playout result comes back, which steers the
+ * other threads elsewhere. A node is expanded by whichever thread claims
+ * it first, from that thread's own arena; the others treat it as a leaf
+ * in the meantime instead of waiting.
+ */
+namespace Mcts {
+
+enum NodeKind : uint8_t { DECISION, CHANCE };
+enum NodeState : uint8_t { UNEXPANDED, EXPANDING, EXPANDED };
+
+struct Entry;
+
+// An edge of the graph: a move, a flip, or one outcome of a flip
+struct Node {
+  std::atomic<uint32_t> visits;
+  std::atomic<int64_t> value; // summed results, in VALUE_UNIT, for the player who moved here
+  std::atomic<uint8_t> state;
+  Node* children;          // valid once state is EXPANDED
+  uint8_t numChildren;
+  NodeKind kind;
+  DarkChess::Move move;    // move or flip leading here
+  DarkChess::Piece piece;  // piece revealed by a chance outcome
+  uint16_t weight;         // hidden pieces of that kind when the outcome was made
+  std::atomic<uint64_t> key;     // position the edge leads to, once walked
+  std::atomic<Entry*> target;    // its table entry, checked against key before use
+
+  void init(NodeKind k, DarkChess::Move m, DarkChess::Piece p = DarkChess::NO_PIECE, int w = 0) {
+    visits.store(0, std::memory_order_relaxed);
+    value.store(0, std::memory_order_relaxed);
+    state.store(UNEXPANDED, std::memory_order_relaxed);
+    children = nullptr;
+    numChildren = 0;
+    kind = k;
+    move = m;
+    piece = p;
+    weight = w;
+    key.store(0, std::memory_order_relaxed);
+    target.store(nullptr, std::memory_order_relaxed);
+  }
+};
+
+// A position of the graph, shared by every path that reaches it
+struct Entry {
+  std::atomic<uint64_t> key;     // 0 while the slot is free
+  std::atomic<uint32_t> visits;
+  std::atomic<int64_t> value;    // for the player who moved into the position
+  std::atomic<uint8_t> state;
+  std::atomic<Node*> node;       // holds the edges once state is EXPANDED
+};
+
+// Fixed point unit of Node::value
+const int64_t VALUE_UNIT = 1 << 16;
+
+// Bump allocator the tree lives in; a whole tree is released at once
+class Arena {
+  public:
+    void reserve(size_t count) {
+      nodes.reset();
+      nodes = Memory::make_array<Node>(count);
+      capacity = count;
+      used = 0;
+    }
+
+    // n consecutive nodes, or nullptr once the arena is full
+    Node* alloc(size_t n) {
+      if (used + n > capacity) return nullptr;
+      Node* p = &nodes[used];
+      used += n;
+      return p;
+    }
+
+    void reset() { used = 0; }
+    size_t size() const { return used; }
+    size_t max_size() const { return capacity; }
+
+  private:
+    Memory::Array<Node> nodes;
+    size_t capacity = 0;
+    size_t used = 0;
+};
+
+// Positions by key, in buckets of a few entries
+class Table {
+  public:
+    static const int Bucket = 4;
+
+    // Room for at least `count` positions; drops the current contents
+    void resize(size_t count);
+    void clear();
+    size_t size() const { return mask + 1; }
+
+    // Entry of a nonzero key, inserted if missing by taking a free slot of its
+    // bucket or else the least visited one other than keep. Returns
+    // nullptr if every candidate is being expanded.
+    Entry* find(uint64_t key, const Entry* keep);
+
+  private:
+    Memory::Array<Entry> entries;
+    size_t mask = size_t(-1); // size() is 0 until resized
+};
+
+const size_t DEFAULT_NODES = 1 << 20;
+
+// Searches board within ctx.limits, where nodes counts playouts, on one
+// thread per arena, and leaves the most visited move in ctx.bestMove.
+// Arenas that have no room yet get an equal share of totalNodes, and the
+// table is sized to match.
+void search(Search::Context &ctx, const DarkChess::Board &board, Table &table, std::vector<Arena> &arenas,
+            size_t totalNodes = DEFAULT_NODES);
+
+} // namespace Mcts
@@ -0,0 +1,126 @@
+#include "memory.h"
+
+#include <cstdint>
+#include <chrono>
+#include <fcntl.h>
+#include <new>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace Memory {
+
+namespace {
+
+const size_t PageSize = 4096;
+const size_t HugePageSize = 2 * 1024 * 1024;
+
+int prefaultThreads = 0;
+
+size_t rounded(size_t bytes) {
+  size_t unit = bytes >= HugePageSize ? HugePageSize : PageSize;
+  return (bytes + unit - 1) / unit * unit;
+}
+
+void* map(size_t size, int flags) {
+  void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+  return p == MAP_FAILED ? nullptr : p;
+}
+
+// Writing one zero per page faults it in without changing the contents;
+// pages others may have written are only read
+void prefault(char* p, size_t size, int threads, bool write = true) {
+  size_t pages = size / PageSize;
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; t++) {
+    pool.emplace_back([=]() {
+      for (size_t i = pages * t / threads; i < pages * (t + 1) / threads; i++) {
+        volatile char* c = p + i * PageSize;
+        if (write) *c = 0;
+        else (void)*c;
+      }
+    });
+  }
+  for (auto &t : pool) t.join();
+}
+
+} // namespace
+
+void* allocate(size_t bytes, Backing* backing) {
+  size_t size = rounded(bytes == 0 ? 1 : bytes);
+  Backing b = SMALL_PAGES;
+  char* p = nullptr;
+  if (size >= HugePageSize) {
+#ifdef MAP_HUGETLB
+    p = static_cast<char*>(map(size, MAP_HUGETLB));
+    if (p) b = HUGETLB;
+#endif
+    if (!p) {
+      // Map a huge page more than needed and trim both ends to a boundary
+      char* raw = static_cast<char*>(map(size + HugePageSize, 0));
+      if (!raw) throw std::bad_alloc();
+      p = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(raw) + HugePageSize - 1) & ~(HugePageSize - 1));
+      if (p > raw) munmap(raw, p - raw);
+      munmap(p + size, raw + HugePageSize - p);
+#ifdef MADV_HUGEPAGE
+      if (madvise(p, size, MADV_HUGEPAGE) == 0) b = TRANSPARENT;
+#endif
+    }
+  } else {
+    p = static_cast<char*>(map(size, 0));
+    if (!p) throw std::bad_alloc();
+  }
+  if (prefaultThreads > 0) prefault(p, size, prefaultThreads);
+  if (backing) *backing = b;
+  return p;
+}
+
+void* map_shared(const std::string &name, size_t &bytes) {
+  std::string path = name[0] == '/' ? name : "/" + name;
+  size_t size = rounded(bytes == 0 ? 1 : bytes);
+  int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd >= 0) {
+    if (ftruncate(fd, size) != 0) {
+      close(fd);
+      shm_unlink(path.c_str());
+      return nullptr;
+    }
+  } else {
+    fd = shm_open(path.c_str(), O_RDWR, 0600);
+    if (fd < 0) return nullptr;
+    // The creator may not have sized it yet
+    struct stat st;
+    auto start = std::chrono::steady_clock::now();
+    while (fstat(fd, &st) == 0 && st.st_size == 0
+           && std::chrono::steady_clock::now() - start < std::chrono::seconds(1)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || rounded(st.st_size) != size_t(st.st_size)) {
+      close(fd);
+      return nullptr;
+    }
+    size = st.st_size;
+  }
+
+  void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return nullptr;
+#ifdef MADV_HUGEPAGE
+  if (size >= HugePageSize) madvise(p, size, MADV_HUGEPAGE);
+#endif
+  if (prefaultThreads > 0) prefault(static_cast<char*>(p), size, prefaultThreads, false);
+  bytes = size;
+  return p;
+}
+
+void release(void* p, size_t bytes) {
+  munmap(p, rounded(bytes == 0 ? 1 : bytes));
+}
+
+void set_prefault(int threads) {
+  prefaultThreads = threads;
+}
+
+} // namespace Memory
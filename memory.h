@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+/*
+ * Allocation of the big tables: the transposition table, the eval cache,
+ * the MCTS table and arenas and the tablebase generator's bitmaps.
+ *
+ * Memory comes straight from mmap, zeroed. A table of 2 MB or more is
+ * placed on 2 MB boundaries so the kernel can back it with huge pages and
+ * spare the TLB: explicit hugetlb pages when some are reserved, otherwise
+ * ordinary pages marked for transparent huge pages with madvise, otherwise
+ * ordinary pages. Smaller tables get ordinary pages. Every table starts
+ * on a page boundary, so on a cache line boundary too.
+ */
+namespace Memory {
+
+enum Backing { HUGETLB, TRANSPARENT, SMALL_PAGES };
+
+// Zeroed memory of at least bytes, page aligned; throws std::bad_alloc
+void* allocate(size_t bytes, Backing* backing = nullptr);
+void release(void* p, size_t bytes);
+
+// Memory shared with every process that maps the POSIX shared memory
+// object name. The first one creates it zeroed with bytes (rounded like
+// allocate, so release frees it); the others get its size in bytes. The
+// object stays until removed from /dev/shm. nullptr on failure.
+void* map_shared(const std::string &name, size_t &bytes);
+
+// Threads that touch every page of a new allocation before it is handed
+// out, so the page faults are taken in parallel up front; 0 leaves them
+// to first use
+void set_prefault(int threads);
+
+struct Deleter {
+  size_t bytes;
+  Deleter(size_t b = 0) : bytes(b) {}
+  void operator()(void* p) const {
+    if (p) release(p, bytes);
+  }
+};
+
+template <typename T>
+using Array = std::unique_ptr<T[], Deleter>;
+
+// Array of count zeroed elements; nothing is constructed or destroyed
+template <typename T>
+Array<T> make_array(size_t count) {
+  static_assert(std::is_trivially_destructible<T>::value, "arrays are released without destructors");
+  size_t bytes = count * sizeof(T);
+  return Array<T>(static_cast<T*>(allocate(bytes)), Deleter(bytes));
+}
+
+} // namespace Memory
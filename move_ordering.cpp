@@ -1,3 +1,5 @@
+#include <cstdlib>
+
 #include "move_ordering.h"
 
 int sq_distance[SQUARE_NB][SQUARE_NB];
@@ -0,0 +1,134 @@
+#include "nnue.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NNUE_X86 1
+#endif
+
+namespace Nnue {
+
+const int16_t* featureBias = nullptr;
+const int16_t* featureWeights = nullptr;
+
+namespace {
+
+const char Magic[4] = {'C', 'D', 'N', 'N'};
+const uint32_t Version = 1;
+// Right shift bringing the second layer back to the 0..127 range
+const int L2Shift = 6;
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint32_t features;
+  uint32_t hidden;
+  uint32_t l2;
+  int32_t scale;
+  uint32_t reserved[2];
+};
+
+const int32_t* bias2 = nullptr;
+const int8_t* weight2 = nullptr;
+int32_t bias3 = 0;
+const int8_t* weight3 = nullptr;
+int32_t scale = 1;
+
+// Second layer sums of the clipped accumulators, one per neuron
+void layer2_scalar(const uint8_t* input, int32_t* out) {
+  for (int j = 0; j < L2; j++) {
+    const int8_t* w = weight2 + j * 2 * HIDDEN;
+    int32_t sum = bias2[j];
+    for (int i = 0; i < 2 * HIDDEN; i++) sum += input[i] * w[i];
+    out[j] = sum;
+  }
+}
+
+#ifdef NNUE_X86
+// Inputs are at most 127, so maddubs never saturates on a pair
+__attribute__((target("avx2")))
+void layer2_avx2(const uint8_t* input, int32_t* out) {
+  static_assert(2 * HIDDEN % 32 == 0, "the input is read in 32-byte chunks");
+  const __m256i ones = _mm256_set1_epi16(1);
+  for (int j = 0; j < L2; j++) {
+    const int8_t* w = weight2 + j * 2 * HIDDEN;
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < 2 * HIDDEN; i += 32) {
+      __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+      __m256i wt = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + i));
+      sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(in, wt), ones));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    out[j] = bias2[j] + _mm_cvtsi128_si32(s);
+  }
+}
+#endif
+
+void (*layer2)(const uint8_t*, int32_t*) = layer2_scalar;
+
+inline uint8_t clip(int v) {
+  return uint8_t(std::min(127, std::max(0, v)));
+}
+
+} // namespace
+
+bool load(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  const size_t size = sizeof(Header) + sizeof(int16_t) * (HIDDEN + FEATURES * HIDDEN)
+                    + sizeof(int32_t) * L2 + 2 * HIDDEN * L2 + sizeof(int32_t) + L2;
+  struct stat st;
+  void* map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && size_t(st.st_size) == size) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) return false;
+
+  const Header* h = static_cast<const Header*>(map);
+  if (memcmp(h->magic, Magic, 4) || h->version != Version || h->features != uint32_t(FEATURES)
+      || h->hidden != uint32_t(HIDDEN) || h->l2 != uint32_t(L2) || h->scale <= 0) {
+    munmap(map, st.st_size);
+    return false;
+  }
+  const char* p = reinterpret_cast<const char*>(h + 1);
+  featureBias = reinterpret_cast<const int16_t*>(p);
+  p += sizeof(int16_t) * HIDDEN;
+  featureWeights = reinterpret_cast<const int16_t*>(p);
+  p += sizeof(int16_t) * FEATURES * HIDDEN;
+  bias2 = reinterpret_cast<const int32_t*>(p);
+  p += sizeof(int32_t) * L2;
+  weight2 = reinterpret_cast<const int8_t*>(p);
+  p += 2 * HIDDEN * L2;
+  memcpy(&bias3, p, sizeof(bias3));
+  p += sizeof(bias3);
+  weight3 = reinterpret_cast<const int8_t*>(p);
+  scale = h->scale;
+
+#ifdef NNUE_X86
+  if (__builtin_cpu_supports("avx2")) layer2 = layer2_avx2;
+#endif
+  return true;
+}
+
+int evaluate(const Accumulator &acc) {
+  uint8_t input[2 * HIDDEN];
+  for (int c = 0; c < DarkChess::COLOR_NB; c++) {
+    for (int i = 0; i < HIDDEN; i++) input[c * HIDDEN + i] = clip(acc.v[c][i]);
+  }
+  int32_t hidden[L2];
+  layer2(input, hidden);
+  int32_t out = bias3;
+  for (int j = 0; j < L2; j++) out += clip(hidden[j] >> L2Shift) * weight3[j];
+  return out / scale;
+}
+
+} // namespace Nnue
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "types.h"
+
+/*
+ * Optional neural network evaluation, updated incrementally.
+ *
+ * The inputs are one feature per occupied square: 32 squares times 15
+ * states (the 14 pieces and dark). The first layer lives in every Board
+ * as an accumulator, updated by put_piece, remove_piece and move_piece,
+ * once from red's side and once from black's through the rank mirror and
+ * the colour swap, so both views share one set of weights. Evaluating runs
+ * the two small layers behind it on the clipped accumulators in 8-bit
+ * arithmetic, with AVX2 when the CPU has it.
+ *
+ * Weights are memory-mapped from a file:
+ *   header   {magic "CDNN", version, features, hidden, l2, scale, 0, 0}
+ *   int16    bias1[HIDDEN], weight1[FEATURES][HIDDEN]
+ *   int32    bias2[L2]
+ *   int8     weight2[L2][2 * HIDDEN]   red's half first
+ *   int32    bias3
+ *   int8     weight3[L2]
+ * The output divided by scale is red's score. Without a network the board
+ * keeps its material evaluation.
+ */
+namespace Nnue {
+
+const int FEATURES = DarkChess::SQUARE_NB * 15;
+const int HIDDEN = 32; // accumulator width of each side
+const int L2 = 32;
+
+struct Accumulator {
+  int16_t v[DarkChess::COLOR_NB][HIDDEN];
+};
+
+// First layer of the loaded network, nullptr without one
+extern const int16_t* featureBias;
+extern const int16_t* featureWeights;
+
+// Maps a network file; boards set up before loading keep stale
+// accumulators, so load before the first position
+bool load(const std::string &path);
+
+inline bool enabled() { return featureWeights != nullptr; }
+
+// Feature of a piece on a square as seen from side c
+inline int feature(DarkChess::Color c, DarkChess::Square s, DarkChess::Piece pc) {
+  if (c == DarkChess::BLACK) {
+    s = DarkChess::mirror(s, 2);
+    pc = DarkChess::mirror(pc, DarkChess::SYM_COLOR);
+  }
+  return int(s) * 15 + DarkChess::get_piece(pc);
+}
+
+inline void reset(Accumulator &acc) {
+  for (int c = 0; c < DarkChess::COLOR_NB; c++) {
+    for (int i = 0; i < HIDDEN; i++) acc.v[c][i] = featureBias ? featureBias[i] : 0;
+  }
+}
+
+inline void add(Accumulator &acc, DarkChess::Square s, DarkChess::Piece pc) {
+  for (DarkChess::Color c = DarkChess::RED; c < DarkChess::COLOR_NB; ++c) {
+    const int16_t* w = featureWeights + feature(c, s, pc) * HIDDEN;
+    for (int i = 0; i < HIDDEN; i++) acc.v[c][i] += w[i];
+  }
+}
+
+inline void remove(Accumulator &acc, DarkChess::Square s, DarkChess::Piece pc) {
+  for (DarkChess::Color c = DarkChess::RED; c < DarkChess::COLOR_NB; ++c) {
+    const int16_t* w = featureWeights + feature(c, s, pc) * HIDDEN;
+    for (int i = 0; i < HIDDEN; i++) acc.v[c][i] -= w[i];
+  }
+}
+
+inline void move(Accumulator &acc, DarkChess::Square from, DarkChess::Square to, DarkChess::Piece pc) {
+  for (DarkChess::Color c = DarkChess::RED; c < DarkChess::COLOR_NB; ++c) {
+    const int16_t* wFrom = featureWeights + feature(c, from, pc) * HIDDEN;
+    const int16_t* wTo = featureWeights + feature(c, to, pc) * HIDDEN;
+    for (int i = 0; i < HIDDEN; i++) acc.v[c][i] += wTo[i] - wFrom[i];
+  }
+}
+
+// Red's score of the position behind acc
+int evaluate(const Accumulator &acc);
+
+} // namespace Nnue
@@ -0,0 +1,271 @@
+#include "referee.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <poll.h>
+#include <random>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "engine.h"
+
+using namespace DarkChess;
+
+namespace Referee {
+
+bool EngineProcess::start() {
+  stop();
+
+  // Split the command line on spaces before forking
+  std::vector<std::string> words;
+  std::istringstream ss(cmdline);
+  std::string word;
+  while (ss >> word) words.push_back(word);
+  if (words.empty()) return false;
+  std::vector<char*> argv;
+  for (auto &w : words) argv.push_back(&w[0]);
+  argv.push_back(NULL);
+
+  // Close-on-exec, so engines started by other threads don't hold our pipes
+  int toChild[2], fromChild[2];
+  if (pipe2(toChild, O_CLOEXEC) < 0) return false;
+  if (pipe2(fromChild, O_CLOEXEC) < 0) {
+    close(toChild[0]);
+    close(toChild[1]);
+    return false;
+  }
+
+  pid = fork();
+  if (pid == 0) {
+    dup2(toChild[0], STDIN_FILENO);
+    dup2(fromChild[1], STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull >= 0) dup2(devnull, STDERR_FILENO);
+    execvp(argv[0], argv.data());
+    _exit(127);
+  }
+
+  close(toChild[0]);
+  close(fromChild[1]);
+  if (pid < 0) {
+    close(toChild[1]);
+    close(fromChild[0]);
+    return false;
+  }
+  in = toChild[1];
+  out = fromChild[0];
+  buffer.clear();
+  return true;
+}
+
+void EngineProcess::stop() {
+  if (pid <= 0) return;
+  close(in);
+  close(out);
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+  pid = -1;
+  in = out = -1;
+}
+
+bool EngineProcess::read_line(std::string &line, double timeout) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout);
+  for (;;) {
+    size_t nl = buffer.find('\n');
+    if (nl != std::string::npos) {
+      line = buffer.substr(0, nl);
+      buffer.erase(0, nl + 1);
+      return true;
+    }
+
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+    if (left.count() <= 0) return false;
+    struct pollfd pfd = {out, POLLIN, 0};
+    if (poll(&pfd, 1, left.count()) <= 0) continue;
+
+    char chunk[4096];
+    ssize_t n = read(out, chunk, sizeof(chunk));
+    if (n <= 0) return false;
+    buffer.append(chunk, n);
+  }
+}
+
+bool EngineProcess::command(int id, const std::string &args, std::string &reply, double timeout) {
+  if (!alive()) return false;
+
+  char head[16];
+  snprintf(head, sizeof(head), "%d ", id);
+  std::string msg = head + args + "\n";
+  if (write(in, msg.c_str(), msg.size()) != ssize_t(msg.size())) {
+    stop();
+    return false;
+  }
+
+  // Engines also dump boards on stdout; only "=id" / "?id" lines are replies
+  std::string line;
+  auto start = std::chrono::steady_clock::now();
+  for (;;) {
+    std::chrono::duration<double> spent = std::chrono::steady_clock::now() - start;
+    if (!read_line(line, timeout - spent.count())) {
+      stop();
+      return false;
+    }
+    if ((line[0] == '=' || line[0] == '?') && atoi(line.c_str() + 1) == id) break;
+  }
+
+  size_t sp = line.find(' ');
+  reply = sp == std::string::npos ? "" : line.substr(sp + 1);
+  return line[0] == '=';
+}
+
+void deal(uint64_t seed, Piece pieces[SQUARE_NB]) {
+  const int count[KING + 1] = {5, 2, 2, 2, 2, 2, 1};
+  int n = 0;
+  for (Color c = RED; c < COLOR_NB; ++c) {
+    for (PieceType pt = PAWN; pt <= KING; ++pt) {
+      for (int i = 0; i < count[pt]; i++) {
+        pieces[n++] = make_piece(c, pt);
+      }
+    }
+  }
+
+  // Fisher-Yates with our own draws, std::shuffle differs between libraries
+  std::mt19937_64 rng(seed);
+  for (int i = SQUARE_NB - 1; i > 0; i--) {
+    std::swap(pieces[i], pieces[rng() % (i + 1)]);
+  }
+}
+
+static const char* color_name(Color c) {
+  return c == RED ? "red" : (c == BLACK ? "black" : "unknown");
+}
+
+static bool parse_square(const std::string &s, size_t pos, Square &sq) {
+  if (pos + 1 >= s.size()) return false;
+  int f = tolower(s[pos]) - 'a', r = s[pos + 1] - '1';
+  if (f < FILE_A || f > FILE_D || r < RANK_1 || r > RANK_8) return false;
+  sq = make_square(File(f), Rank(r));
+  return true;
+}
+
+GameResult play(EngineProcess* engines[2], uint64_t seed, const Settings &settings) {
+  Piece hidden[SQUARE_NB];
+  deal(seed, hidden);
+
+  Board board;
+  board.init();
+  Color colorOf[2] = {COLOR_NONE, COLOR_NONE};
+  int alive[COLOR_NB] = {16, 16};
+  double clock[2] = {settings.time, settings.time};
+  GameResult result = {-1, "max plies", 0, ""};
+  std::string reply, plies;
+
+  for (int e = 0; e < 2; e++) {
+    if (!engines[e]->alive()) engines[e]->start();
+    if (!engines[e]->command(RESET_BOARD, "reset_board", reply, 10)) {
+      result = {1 - e, "crash", 0};
+      return result;
+    }
+  }
+
+  int turn = 0;
+  for (int ply = 0; ply < settings.maxPlies; ply++, turn ^= 1) {
+    EngineProcess* e = engines[turn];
+    const char* us = color_name(colorOf[turn]);
+    char args[64];
+
+    snprintf(args, sizeof(args), "time_left %s %d", us, int(clock[turn]));
+    e->command(TIME_LEFT, args, reply, 10);
+
+    auto start = std::chrono::steady_clock::now();
+    bool ok = e->command(GENMOVE, std::string("genmove ") + us, reply, clock[turn] + 1);
+    std::chrono::duration<double> spent = std::chrono::steady_clock::now() - start;
+    clock[turn] -= spent.count();
+    if (clock[turn] < 0) {
+      result = {1 - turn, "time forfeit", ply};
+      break;
+    }
+    if (!ok) {
+      result = {1 - turn, e->alive() ? "genmove failed" : "crash", ply};
+      break;
+    }
+
+    Square from, to;
+    if (!parse_square(reply, 0, from) || !parse_square(reply, 3, to)) {
+      result = {1 - turn, "bad reply: " + reply, ply};
+      break;
+    }
+
+    std::string cmd;
+    if (from == to) {
+      if (!board.is_dark(from)) {
+        result = {1 - turn, "illegal flip " + reply, ply};
+        break;
+      }
+      Piece p = hidden[from];
+      board.flip_move(make_move(from, from), p, color_of(p));
+      if (colorOf[turn] == COLOR_NONE) {
+        colorOf[turn] = color_of(p);
+        colorOf[1 - turn] = ~color_of(p);
+      }
+      cmd = "flip " + reply.substr(0, 2) + " " + board.print_piece(p);
+      plies += " " + reply.substr(0, 2) + "=" + board.print_piece(p);
+    } else {
+      MoveList mList;
+      ScoreList sList;
+      int size = board.get_legal_moves(mList, sList);
+      Move m = make_move(from, to);
+      bool legal = board.side_to_move() == colorOf[turn]
+                && std::find(mList.begin(), mList.begin() + size, m) != mList.begin() + size;
+      if (!legal) {
+        result = {1 - turn, "illegal move " + reply, ply};
+        break;
+      }
+      Piece captured;
+      board.do_move(m, captured);
+      if (captured != NO_PIECE) alive[color_of(captured)]--;
+      cmd = "move " + reply.substr(0, 5);
+      plies += " " + reply.substr(0, 2) + "-" + reply.substr(3, 2);
+    }
+
+    for (int i = 0; i < 2; i++) {
+      engines[i]->command(cmd[0] == 'f' ? FLIP : MOVE, cmd, reply, 10);
+    }
+
+    // Does the side now to move have anything left?
+    Color them = board.side_to_move();
+    MoveList mList;
+    ScoreList sList;
+    if (alive[them] == 0) {
+      result = {turn, "all pieces captured", ply + 1};
+      break;
+    }
+    if (board.get_legal_moves(mList, sList) == 0 && board.num_of_dark_pieces() == 0) {
+      result = {turn, "no legal moves", ply + 1};
+      break;
+    }
+    if (board.getNoCFMoves() >= 60) {
+      result = {-1, "60 moves without capture or flip", ply + 1};
+      break;
+    }
+    if (board.getRepetition() >= 9) {
+      result = {-1, "repetition", ply + 1};
+      break;
+    }
+    result.plies = ply + 1;
+  }
+
+  Color winner = result.winner < 0 ? COLOR_NONE : colorOf[result.winner];
+  result.record = (winner == COLOR_NONE ? "draw" : color_name(winner)) + plies;
+
+  for (int i = 0; i < 2; i++) {
+    const char* outcome = result.winner < 0 ? "draw" : (result.winner == i ? "win" : "lose");
+    engines[i]->command(GAME_OVER, std::string("game_over ") + outcome, reply, 10);
+  }
+  return result;
+}
+
+} // namespace Referee
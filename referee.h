@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <sys/types.h>
+
+#include "state.h"
+
+/*
+ * Local referee for the "id command args" protocol spoken by main_cdc.cpp.
+ *
+ * The referee plays the part of the game server: it deals the hidden
+ * pieces from a seeded shuffle, asks engines for moves with genmove,
+ * checks them against the Board rules, forwards every flip/move to both
+ * engines and tells them the result with game_over.
+ */
+namespace Referee {
+
+// An engine running as a child process, talking over its stdin/stdout
+class EngineProcess {
+  public:
+    EngineProcess(const std::string &_cmdline) : cmdline(_cmdline) {}
+    ~EngineProcess() { stop(); }
+
+    bool start();
+    void stop();
+    bool alive() const { return pid > 0; }
+    const std::string &name() const { return cmdline; }
+
+    // Sends "id command args" and waits up to timeout seconds for the
+    // "=id" / "?id" reply, whose text (without the prefix) goes to reply.
+    // Fails, and kills the engine, if it exits or does not answer in time.
+    bool command(int id, const std::string &args, std::string &reply, double timeout);
+
+  private:
+    bool read_line(std::string &line, double timeout);
+
+    std::string cmdline;
+    pid_t pid = -1;
+    int in = -1;  // engine's stdin
+    int out = -1; // engine's stdout
+    std::string buffer;
+};
+
+struct Settings {
+  double time = 900;   // seconds on each clock
+  int maxPlies = 1000; // adjudicated as a draw beyond this
+};
+
+struct GameResult {
+  int winner;         // index into the engines array, -1 for a draw
+  std::string reason;
+  int plies;
+  std::string record; // "<red|black|draw> a1=k a1-a2 ...", as read by Book::build
+};
+
+// Deals the 32 pieces onto the squares; the same seed gives the same deal
+void deal(uint64_t seed, DarkChess::Piece pieces[DarkChess::SQUARE_NB]);
+
+// Plays one game, engines[0] moves first
+GameResult play(EngineProcess* engines[2], uint64_t seed, const Settings &settings);
+
+} // namespace Referee
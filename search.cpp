@@ -1,40 +1,211 @@
 #include "search.h"
+#include "evalcache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 namespace Search {
 
-DarkChess::Move _bestMove;
-int _bestScore;
-DarkChess::Color Us;
 Trans::TranspTable tt;
-std::chrono::time_point<std::chrono::system_clock> start, end;
-std::chrono::duration<double> elapsed_seconds;
 
-void iterDeep(DarkChess::Board initialBoard) {
-  //for (int currDepth = 6; currDepth <= MAX_DEPTH; currDepth += 1) {
-    int currDepth = 6;
+// Null move: the reduction, and the pieces the side to move needs before
+// passing is safe from zugzwang
+static const int NullReduction = 2;
+static const int NullMinPieces = 3;
+// Late move reductions apply to quiet moves after the first few
+static const int LmrMinDepth = 3;
+static const int LmrFirstMove = 3;
+
+// TT key of the board, and the symmetry mapping the board onto the stored
+// position; moves go through that symmetry on the way in and out
+static uint64_t tt_key(const Context &ctx, const DarkChess::Board &board, int &sym) {
+  sym = 0;
+  if (ctx.hidden) return board.getHash() ^ ctx.keyMix;
+  return DarkChess::symmetricHashing ? board.canonical_hash(sym) : board.getHash();
+}
+
+// Determinized search: flips the square of m to its assumed piece, which
+// leaves the key mix now that the board hash has it; undone after the
+// child is searched
+static void flip_hidden(Context &ctx, DarkChess::Board &board, DarkChess::Move m) {
+  DarkChess::Square s = from_sq(m);
+  DarkChess::Piece p = ctx.hidden[s];
+  board.flip_move(m, p, color_of(p));
+  ctx.keyMix ^= DarkChess::hashArray[s][DarkChess::get_piece(p)];
+}
+
+static void flip_hidden_undo(Context &ctx, DarkChess::Move m) {
+  DarkChess::Square s = from_sq(m);
+  ctx.keyMix ^= DarkChess::hashArray[s][DarkChess::get_piece(ctx.hidden[s])];
+}
+
+// TT key of the position after the normal move m, without making it
+static uint64_t child_key(const Context &ctx, const DarkChess::Board &board, DarkChess::Move m) {
+  if (ctx.hidden) return board.hash_after(m, false) ^ ctx.keyMix;
+  return board.hash_after(m, DarkChess::symmetricHashing);
+}
+
+// Starts loading what the search of the child after move m looks up
+// first: its TT bucket, or its eval cache slot if it is a leaf
+static void prefetch_child(const Context &ctx, const DarkChess::Board &board, DarkChess::Move m, int depth) {
+  if (depth > 1) {
+    tt.prefetch(child_key(ctx, board, m));
+  } else {
+    DarkChess::evalCache.prefetch(board.eval_key_after(m));
+  }
+}
+
+// Follows best moves through the TT from board after first, as far as
+// they stay legal
+static std::vector<DarkChess::Move> principal_variation(const Context &ctx, DarkChess::Board board,
+                                                        DarkChess::Move first, int depth) {
+  std::vector<DarkChess::Move> pv;
+  DarkChess::Move m = first;
+  while (m < DarkChess::MOVE_PASS && is_move_ok(m) && int(pv.size()) < depth) {
+    DarkChess::MoveList mList;
+    DarkChess::ScoreList sList;
+    int size = board.get_legal_moves(mList, sList);
+    if (std::find(mList.begin(), mList.begin() + size, m) == mList.begin() + size) break;
+    DarkChess::Piece captured;
+    board.do_move(m, captured);
+    pv.push_back(m);
+
+    Trans::TTEntry entry;
+    int sym;
+    if (!tt.probe(tt_key(ctx, board, sym), entry)) break;
+    m = DarkChess::mirror(entry.bestMove, sym);
+  }
+  // A flip chosen at the root is a line of its own
+  if (pv.empty() && first != DarkChess::MOVE_NULL) pv.push_back(first);
+  return pv;
+}
+
+// One machine-readable line per root line of a finished iteration:
+// info depth D multipv K score S nodes N nps N time MS pv a1-a2 ...
+static void report(const Context &ctx, const DarkChess::Board &board, int depth) {
+  std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - ctx.start;
+  double seconds = std::max(elapsed.count(), 1e-6);
+  for (size_t k = 0; k < ctx.lines.size(); k++) {
+    std::string pv;
+    for (DarkChess::Move m : principal_variation(ctx, board, ctx.lines[k].move, depth)) {
+      std::string move = board.print_move(m);
+      move[2] = '-';
+      pv += " " + move;
+    }
+    fprintf(ctx.info, "info depth %d multipv %d score %d nodes %llu nps %llu time %d pv%s\n",
+            depth, int(k + 1), ctx.lines[k].score, (unsigned long long)ctx.nodes,
+            (unsigned long long)(ctx.nodes / seconds), int(seconds * 1000), pv.c_str());
+  }
+  fflush(ctx.info);
+}
+
+// Move the root search should try first: the expected one if the game
+// went along the last principal variation, else the TT's
+static DarkChess::Move root_hint(const Context &ctx, const DarkChess::Board &board) {
+  if (ctx.pv.size() > 2 && ctx.pvKey == board.getHash()) return ctx.pv[2];
+  Trans::TTEntry entry;
+  int sym;
+  if (tt.probe(tt_key(ctx, board, sym), entry)) return DarkChess::mirror(entry.bestMove, sym);
+  return DarkChess::MOVE_NULL;
+}
+
+// Brings m to the front of the list, keeping the order of the others
+static void move_to_front(DarkChess::MoveList &list, int size, DarkChess::Move m) {
+  auto end = list.begin() + size;
+  auto it = std::find(list.begin(), end, m);
+  if (it != end) std::rotate(list.begin(), it, it + 1);
+}
+
+void iterDeep(Context &ctx, DarkChess::Board initialBoard) {
+  int maxDepth = ctx.limits.depth;
+  if (maxDepth <= 0) {
+    maxDepth = 6;
     if (initialBoard.get_gameLength() > 50) {
-      currDepth = 12;
+      maxDepth = 12;
     }
-    start = std::chrono::system_clock::now(); 
-    rootMax(initialBoard, currDepth);
-    end = std::chrono::system_clock::now();
-    elapsed_seconds = end - start;
-    //std::cout << "bestScore " << _bestScore << " " << initialBoard.print_move(_bestMove) << std::endl;
-    //std::cout << "Depth " << currDepth << " time: " << elapsed_seconds.count() << std::endl;
-  //}
+  }
+  ctx.start = std::chrono::system_clock::now();
+  ctx.nodes = 0;
+  ctx.tbHits = 0;
+  ctx.depth = 0;
+  ctx.stopped = false;
+  DarkChess::EvalCache::Stats evalBefore = DarkChess::EvalCache::thread_stats();
+  tt.new_search();
+  // Each iteration tries the best move of the one before first
+  ctx.bestMove = root_hint(ctx, initialBoard);
+
+  DarkChess::Move bestMove = DarkChess::MOVE_NULL;
+  int bestScore = -INF;
+  std::vector<Line> lines;
+  ctx.lines.clear();
+  for (int currDepth = 1; currDepth <= maxDepth; currDepth += 1) {
+    rootMax(ctx, initialBoard, currDepth);
+    // An interrupted iteration only counts if it is the only one we have
+    if (ctx.stopped && ctx.depth > 0) break;
+    bestMove = ctx.bestMove;
+    bestScore = ctx.bestScore;
+    lines = ctx.lines;
+    ctx.depth = currDepth;
+    if (ctx.info) report(ctx, initialBoard, currDepth);
+    if (ctx.stopped) break;
+  }
+  ctx.bestMove = bestMove;
+  ctx.bestScore = bestScore;
+  ctx.lines.swap(lines);
+
+  ctx.pv = principal_variation(ctx, initialBoard, bestMove, ctx.depth);
+  ctx.pvKey = 0;
+  if (ctx.pv.size() > 2) {
+    DarkChess::Board expected = initialBoard;
+    DarkChess::Piece captured;
+    expected.do_move(ctx.pv[0], captured);
+    expected.do_move(ctx.pv[1], captured);
+    ctx.pvKey = expected.getHash();
+  }
+  ctx.evalProbes = DarkChess::EvalCache::thread_stats().probes - evalBefore.probes;
+  ctx.evalHits = DarkChess::EvalCache::thread_stats().hits - evalBefore.hits;
+
+  // FNV-1a over the node count and the chosen move
+  ctx.totalNodes += ctx.nodes;
+  uint64_t words[2] = {ctx.nodes, uint64_t(bestMove)};
+  for (uint64_t w : words) {
+    ctx.signature = (ctx.signature ^ w) * 0x100000001B3ULL;
+  }
+}
+
+// Polled at every node, sets ctx.stopped once the time or node budget is spent
+static bool out_of_budget(Context &ctx) {
+  if (ctx.stopped) return true;
+  if (ctx.limits.nodes && ctx.nodes >= ctx.limits.nodes) {
+    ctx.stopped = true;
+  } else if (ctx.limits.time > 0) {
+    std::chrono::duration<double> elapsed_seconds = std::chrono::system_clock::now() - ctx.start;
+    ctx.stopped = elapsed_seconds.count() >= ctx.limits.time;
+  }
+  return ctx.stopped;
 }
 
-void rootMax(DarkChess::Board &board, int depth) {
+void rootMax(Context &ctx, DarkChess::Board &board, int depth) {
   DarkChess::MoveList legalMoves;
   DarkChess::ScoreList scoreMoves;
   DarkChess::Piece captured;
   int size = board.get_legal_moves(legalMoves, scoreMoves);
   int flip = board.num_of_dark_pieces();
+  // The lines of the last iteration go first, in their order
+  std::vector<Line> previous;
+  previous.swap(ctx.lines);
+  for (size_t k = previous.size(); k-- > 1; ) move_to_front(legalMoves, size, previous[k].move);
+  move_to_front(legalMoves, size, ctx.bestMove);
 
   // No legal moves available
   if (size == 0 && flip == 0) {
-    _bestMove = DarkChess::MOVE_NULL; // not the best choice
-    _bestScore = -INF;
+    ctx.bestMove = DarkChess::MOVE_NULL; // not the best choice
+    ctx.bestScore = -INF;
     //std::cout << "LOSE no legal moves, bestScore = -INF\n";
     return;
   };
@@ -43,33 +214,45 @@ void rootMax(DarkChess::Board &board, int depth) {
   int beta = INF;
   int currScore;
   DarkChess::Move bestMove = DarkChess::MOVE_NULL;
-  Us = board.side_to_move();
+  ctx.Us = board.side_to_move();
+  // Moves are searched against the worst of the best multiPV lines so
+  // far, so every line kept has an exact score; with one line that is
+  // plain alpha
+  size_t multiPV = std::max(1, ctx.multiPV);
   //std::cout << size << " legalMoves\n";
   for (int i = 0; i < size; i++) {
     Board temp = board;
     temp.do_move(legalMoves[i], captured);
-    
-    currScore = -negaScout(temp, depth - 1, -beta, -alpha);
+
+    int bound = ctx.lines.size() < multiPV ? -INF : ctx.lines.back().score;
+    currScore = -negaScout(ctx, temp, depth - 1, -beta, -bound);
     //std::cout << i << " " << board.print_move(legalMoves[i]) << " score " << currScore << std::endl;
     //board.undo_move(legalMoves[i], captured);
-    if (currScore > alpha) {
-      bestMove = legalMoves[i];
-      alpha = currScore;
+    if (currScore > bound) {
+      auto at = std::find_if(ctx.lines.begin(), ctx.lines.end(),
+                             [&](const Line &l) { return currScore > l.score; });
+      ctx.lines.insert(at, Line{legalMoves[i], currScore});
+      if (ctx.lines.size() > multiPV) ctx.lines.pop_back();
     }
-    if (alpha >= beta) break;
+    if (ctx.lines.size() == multiPV && ctx.lines.back().score >= beta) break;
+  }
+  if (!ctx.lines.empty()) {
+    bestMove = ctx.lines[0].move;
+    alpha = ctx.lines[0].score;
   }
-  currScore = board.evaluate(Us);
+  currScore = board.evaluate(ctx.Us);
   if (flip > 0 && (alpha <= currScore || size == 0)) {
     DarkChess::MoveList mList;
     int fsize = board.legal_flip_actions(mList, 0);
-    bestMove = mList[rand() % fsize];
+    bestMove = mList[ctx.rng() % fsize];
     for (int i = 0; i < fsize; i++) {
       int v = 0, n = 0;
-      for (Piece p = R_PAWN; p <= B_KING; ++p) {
+      for (int idx = 0; idx < DarkChess::PIECE_NB; idx++) {
+        Piece p = DarkChess::piece_of_index(idx);
         if (board.is_dark(from_sq(mList[i]))) {
           Board temp = board;
           temp.flip_move(mList[i], p, color_of(p));
-          v = v - negaScout(board, depth - 1, -beta, -alpha);
+          v = v - negaScout(ctx, board, depth - 1, -beta, -alpha);
           //board.undo_flip(mList[i], p, color_of(p));
           n += temp.get_pieceCount(p);
         }
@@ -92,20 +275,25 @@ void rootMax(DarkChess::Board &board, int depth) {
     bestMove = legalMoves[0];
   }
 
+  // A flip or fallback move chosen over the searched lines leads them
+  if (ctx.lines.empty() || ctx.lines[0].move != bestMove) {
+    ctx.lines.insert(ctx.lines.begin(), Line{bestMove, alpha});
+    if (ctx.lines.size() > multiPV) ctx.lines.pop_back();
+  }
+
   // << "bestScore = alpha " << alpha << std::endl;
-  _bestMove = bestMove;
-  _bestScore = alpha;
+  ctx.bestMove = bestMove;
+  ctx.bestScore = alpha;
 }
 
-int negaScout(DarkChess::Board &board, int depth, int alpha, int beta) {
+int negaScout(Context &ctx, DarkChess::Board &board, int depth, int alpha, int beta) {
   int score;
   int alphaOrig = alpha;
   DarkChess::Piece captured;
-  end = std::chrono::system_clock::now();
-  elapsed_seconds = end - start;
+  ctx.nodes++;
 
-  if (depth == 0 || elapsed_seconds.count() >= 6) {
-    score = board.evaluate(Us);
+  if (depth == 0 || out_of_budget(ctx)) {
+    score = board.evaluate(ctx.Us);
     //std::cout << "depth 0 return evaluate\n";
     return score;
   }
@@ -120,18 +308,37 @@ int negaScout(DarkChess::Board &board, int depth, int alpha, int beta) {
     return 0;
   }
 
-  const Trans::TTEntry *ttEntry = tt.getEntry(board.getHash());
+  // Small endings without dark pieces are scored exactly. The tables do
+  // not know the 60-move rule, so a win or loss further off than the
+  // moves left before it is searched instead.
+  Tablebase::Result tbResult;
+  if (Tablebase::probe(board, tbResult)
+      && (tbResult.wdl == 0 || tbResult.distance < 60 - board.getNoCFMoves())) {
+    ctx.tbHits++;
+    if (tbResult.wdl == 0) return 0;
+    return tbResult.wdl * (TB_WIN - tbResult.distance);
+  }
+
+  Trans::TTEntry ttEntry;
+  int sym;
+  uint64_t key = tt_key(ctx, board, sym);
+  DarkChess::Move hashMove = DarkChess::MOVE_NULL;
   // Check transposition table cache
-  if (ttEntry && (ttEntry->depth >= depth)) {
-    switch(ttEntry->flag) {
-      case Trans::EXACT: return ttEntry->score;
-      case Trans::UPPER_BOUND: beta = std::min(beta, ttEntry->score);
+  bool ttHit = tt.probe(key, ttEntry);
+  if (ttHit) {
+    ttEntry.bestMove = DarkChess::mirror(ttEntry.bestMove, sym);
+    hashMove = ttEntry.bestMove;
+  }
+  if (ttHit && (ttEntry.depth >= depth)) {
+    switch(ttEntry.flag) {
+      case Trans::EXACT: return ttEntry.score;
+      case Trans::UPPER_BOUND: beta = std::min(beta, ttEntry.score);
                         break;
-      case Trans::LOWER_BOUND: alpha = std::max(alpha, ttEntry->score);
+      case Trans::LOWER_BOUND: alpha = std::max(alpha, ttEntry.score);
                         break;
     }
     if (alpha >= beta) {
-      return ttEntry->score;
+      return ttEntry.score;
     }
   }
 
@@ -140,6 +347,8 @@ int negaScout(DarkChess::Board &board, int depth, int alpha, int beta) {
   DarkChess::ScoreList scoreMoves;
   int size = board.get_legal_moves(legalMoves, scoreMoves);
   move_ordering(legalMoves, scoreMoves, size);
+  // The move that was best here before, possibly in the previous search
+  move_to_front(legalMoves, size, hashMove);
   int flip = board.num_of_dark_pieces();
   /*std::cout << depth << " sideToPlay " << board.side_to_move() << std::endl;
   std::cout << board.print_board() << std::endl;
@@ -157,24 +366,49 @@ int negaScout(DarkChess::Board &board, int depth, int alpha, int beta) {
     }
     //std::cout << "no legal moves return game score " << score << std::endl;
     return score;
-  } else if (size == 0 && flip > 0) {
+  } else if (size == 0 && flip > 0 && !ctx.hidden) {
     //std::cout << "only flip moves return evaluate\n";
-    return board.evaluate(Us);
+    return board.evaluate(ctx.Us);
   }
 
   // TODO: extend search if king is in danger
   // TODO: quiescent Search if depth is 0
 
+  // Null move: if passing still fails high, a real move will too. Not
+  // with dark pieces left, where the reply may be a flip the search does
+  // not see, nor with so few pieces that having to move can hurt.
+  if (depth > NullReduction && flip == 0 && abs(beta) < TB_WIN / 2
+      && board.num_of_pieces(board.side_to_move()) >= NullMinPieces
+      && board.evaluate(board.side_to_move()) >= beta) {
+    Board temp = board;
+    temp.do_move(DarkChess::MOVE_PASS, captured);
+    score = -negaScout(ctx, temp, depth - 1 - NullReduction, -beta, -beta + 1);
+    if (score >= beta && !ctx.stopped) {
+      return beta;
+    }
+  }
+
   DarkChess::Move bestMove = DarkChess::MOVE_NULL;
 
   for (int i = 0; i < size; i++) {
+    prefetch_child(ctx, board, legalMoves[i], depth);
     Board temp = board;
+    bool quiet = board.piece_on(to_sq(legalMoves[i])) == DarkChess::NO_PIECE;
     temp.do_move(legalMoves[i], captured);
-    
-    score = -negaScout(temp, depth - 1, -beta, -alpha);
+
+    // Quiet moves late in the order are searched shallower with a null
+    // window first, and again in full only if they beat alpha
+    if (quiet && depth >= LmrMinDepth && i >= LmrFirstMove) {
+      int reduction = i >= 2 * LmrFirstMove + 2 && depth >= 2 * LmrMinDepth ? 2 : 1;
+      score = -negaScout(ctx, temp, depth - 1 - reduction, -alpha - 1, -alpha);
+      if (score <= alpha) continue;
+    }
+    score = -negaScout(ctx, temp, depth - 1, -beta, -alpha);
     //board.undo_move(legalMoves[i], captured);
     if (score >= beta) {
       //std::cout << "beta cut off " << beta << std::endl;
+      // Remember the refutation, it comes first next time
+      if (!ctx.stopped) tt.set(key, Trans::TTEntry(beta, depth, DarkChess::mirror(legalMoves[i], sym), Trans::LOWER_BOUND));
       return beta; // beta cut-off
     }
     if (score > alpha) {
@@ -183,8 +417,32 @@ int negaScout(DarkChess::Board &board, int depth, int alpha, int beta) {
     }
   }
 
+  // With the hidden pieces known, flips are searched like moves
+  if (ctx.hidden && flip > 0) {
+    DarkChess::MoveList flips;
+    int fsize = board.legal_flip_actions(flips, 0);
+    for (int i = 0; i < fsize; i++) {
+      Board temp = board;
+      flip_hidden(ctx, temp, flips[i]);
+
+      score = -negaScout(ctx, temp, depth - 1, -beta, -alpha);
+      flip_hidden_undo(ctx, flips[i]);
+      if (score >= beta) {
+        return beta;
+      }
+      if (score > alpha) {
+        bestMove = flips[i];
+        alpha = score;
+      }
+    }
+  }
+
   if (bestMove == DarkChess::MOVE_NULL) {
-    bestMove = legalMoves[0];
+    bestMove = size > 0 ? legalMoves[0] : DarkChess::MOVE_PASS;
+  }
+  // Scores from an interrupted search are not trustworthy
+  if (ctx.stopped) {
+    return alpha;
   }
   // Store bestScore in transposition table
   Trans::Flag _flag;
@@ -193,11 +451,170 @@ int negaScout(DarkChess::Board &board, int depth, int alpha, int beta) {
   } else {
     _flag = Trans::EXACT;
   }
-  Trans::TTEntry newTTEntry(alpha, depth, bestMove, _flag);
-  tt.set(board.getHash(), newTTEntry);
+  Trans::TTEntry newTTEntry(alpha, depth, DarkChess::mirror(bestMove, sym), _flag);
+  tt.set(key, newTTEntry);
 
   //std::cout << "return alpha " << alpha << std::endl;
   return alpha;
 }
 
+size_t hot_entries(const Context &ctx, const DarkChess::Board &root, Trans::TranspTable::Saved* out, size_t max) {
+  // Breadth first from the root, which rootMax does not store, through
+  // the moves between positions the table holds. Only positions found go
+  // on to the next ply, as snapshots, so that stays within max of them.
+  std::vector<DarkChess::Snapshot> level(1, root.snapshot()), next;
+  std::unordered_set<uint64_t> seen;
+  int sym;
+  seen.insert(tt_key(ctx, root, sym));
+  DarkChess::Board board;
+  size_t n = 0;
+  while (!level.empty() && n < max) {
+    next.clear();
+    for (size_t k = 0; k < level.size() && n < max; k++) {
+      board.restore(level[k]);
+      DarkChess::MoveList mList;
+      DarkChess::ScoreList sList;
+      int size = board.get_legal_moves(mList, sList);
+      for (int i = 0; i < size && n < max; i++) {
+        uint64_t key = child_key(ctx, board, mList[i]);
+        if (seen.count(key) || !tt.save(key, out[n])) continue;
+        seen.insert(key);
+        n++;
+        DarkChess::Board child = board;
+        DarkChess::Piece captured;
+        child.do_move(mList[i], captured);
+        next.push_back(child.snapshot());
+      }
+    }
+    level.swap(next);
+  }
+  return n;
+}
+
+// One determinization: the root actions scored by iterative deepening,
+// keeping the best action of the deepest completed iteration
+static void search_sample(Context &ctx, const DarkChess::Board &board, const std::vector<DarkChess::Move> &actions,
+                          int maxDepth, int &best, int &bestScore) {
+  ctx.Us = board.side_to_move();
+  best = -1;
+  for (int depth = 1; depth <= maxDepth; depth++) {
+    int alpha = -INF, iterBest = -1;
+    for (size_t i = 0; i < actions.size(); i++) {
+      Board temp = board;
+      DarkChess::Move m = actions[i];
+      if (is_move_ok(m)) {
+        DarkChess::Piece captured;
+        temp.do_move(m, captured);
+      } else {
+        flip_hidden(ctx, temp, m);
+      }
+      int score = -negaScout(ctx, temp, depth - 1, -INF, -alpha);
+      if (!is_move_ok(m)) flip_hidden_undo(ctx, m);
+      if (ctx.stopped) break;
+      if (iterBest < 0 || score > alpha) {
+        alpha = score;
+        iterBest = i;
+      }
+    }
+    if (ctx.stopped && best >= 0) break;
+    best = iterBest;
+    bestScore = alpha;
+    if (ctx.stopped) break;
+  }
+}
+
+void pimc(Context &ctx, const DarkChess::Board &rootBoard, int samples, int threads) {
+  Board board = rootBoard;
+  DarkChess::MoveList mList, fList;
+  DarkChess::ScoreList sList;
+  int size = board.get_legal_moves(mList, sList);
+  int fsize = board.legal_flip_actions(fList, 0);
+  std::vector<DarkChess::Move> actions(mList.begin(), mList.begin() + size);
+  actions.insert(actions.end(), fList.begin(), fList.begin() + fsize);
+
+  // Nothing to sample before the colours are known or without dark pieces
+  if (board.side_to_move() == DarkChess::COLOR_NONE || fsize == 0 || actions.size() < 2) {
+    iterDeep(ctx, board);
+    return;
+  }
+  ctx.start = std::chrono::system_clock::now();
+  samples = std::max(1, samples);
+  threads = std::max(1, std::min(threads, samples));
+
+  // Every sample's seed is drawn up front, so the samples do not depend
+  // on which worker takes them
+  std::vector<uint32_t> seeds(samples);
+  for (auto &s : seeds) s = ctx.rng();
+
+  std::vector<DarkChess::Piece> pool;
+  for (Color c = DarkChess::RED; c < DarkChess::COLOR_NB; ++c) {
+    for (PieceType pt = DarkChess::PAWN; pt <= DarkChess::KING; ++pt) {
+      DarkChess::Piece p = make_piece(c, pt);
+      for (int n = board.get_hidden(p); n > 0; n--) pool.push_back(p);
+    }
+  }
+
+  int maxDepth = ctx.limits.depth > 0 ? ctx.limits.depth : 4;
+  std::vector<int> votes(actions.size(), 0);
+  std::vector<long long> scoreSum(actions.size(), 0);
+  std::atomic<int> next(0);
+  std::atomic<uint64_t> nodes(0);
+  std::mutex mtx;
+
+  auto worker = [&]() {
+    for (int k; (k = next++) < samples; ) {
+      std::minstd_rand rng(seeds[k]);
+      DarkChess::Piece hidden[DarkChess::SQUARE_NB];
+      std::vector<DarkChess::Piece> deal = pool;
+      for (int i = int(deal.size()) - 1; i > 0; i--) std::swap(deal[i], deal[rng() % (i + 1)]);
+
+      Context local;
+      local.limits = ctx.limits;
+      // Each sample gets its share of the time, counted from its own start
+      local.limits.time = ctx.limits.time * threads / samples;
+      if (ctx.limits.nodes) local.limits.nodes = std::max<uint64_t>(1, ctx.limits.nodes / samples);
+      local.start = std::chrono::system_clock::now();
+      local.hidden = hidden;
+      size_t used = 0;
+      for (DarkChess::Square s = DarkChess::SQ_A1; s < DarkChess::SQUARE_NB; ++s) {
+        if (!board.is_dark(s)) continue;
+        // A FEN may hide more squares than the pool accounts for
+        hidden[s] = used < deal.size() ? deal[used++] : make_piece(Color(rng() % 2), PieceType(rng() % 7));
+        local.keyMix ^= DarkChess::hashArray[s][DarkChess::get_piece(hidden[s])];
+      }
+
+      int best, bestScore;
+      search_sample(local, board, actions, maxDepth, best, bestScore);
+      nodes += local.nodes;
+      if (best < 0) continue;
+      std::lock_guard<std::mutex> lock(mtx);
+      votes[best]++;
+      scoreSum[best] += bestScore;
+    }
+  };
+  std::vector<std::thread> pool_;
+  for (int i = 1; i < threads; i++) pool_.emplace_back(worker);
+  worker();
+  for (auto &t : pool_) t.join();
+
+  // Most votes wins, then the better average score
+  int best = 0;
+  for (size_t i = 1; i < actions.size(); i++) {
+    if (votes[i] > votes[best]
+        || (votes[i] == votes[best] && votes[i] && scoreSum[i] * votes[best] > scoreSum[best] * votes[i])) {
+      best = i;
+    }
+  }
+  ctx.bestMove = actions[best];
+  ctx.bestScore = votes[best] ? int(scoreSum[best] / votes[best]) : 0;
+  ctx.nodes = nodes;
+  ctx.depth = maxDepth;
+
+  ctx.totalNodes += ctx.nodes;
+  uint64_t words[2] = {ctx.nodes, uint64_t(ctx.bestMove)};
+  for (uint64_t w : words) {
+    ctx.signature = (ctx.signature ^ w) * 0x100000001B3ULL;
+  }
+}
+
 } // namespace Search
\ No newline at end of file
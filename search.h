@@ -1,11 +1,15 @@
 #pragma once
 
 #include <chrono>
+#include <cstdio>
 #include <ctime>
+#include <random>
+#include <vector>
 
 #include "state.h"
 #include "tt.h"
 #include "move_ordering.h"
+#include "tablebase.h"
 
 #define INF 2147483647
 
@@ -17,14 +21,75 @@ struct Location {
 
 const int MAX_DEPTH = 6;
 const int MIN_SCORE = 100;
+// Tablebase wins score TB_WIN minus the distance, above any evaluation
+const int TB_WIN = INF / 2;
+
+// What a search may spend. Zero means no limit, except depth where zero
+// picks the default depth for the game phase.
+struct Limits {
+  int depth = 0;
+  uint64_t nodes = 0;
+  double time = 6; // seconds
+};
+
+// A root move with its score, best first
+struct Line {
+  DarkChess::Move move;
+  int score;
+};
+
+// State of one search. Every game owns its own context, so several
+// searches can run at once against the shared transposition table.
+struct Context {
+  DarkChess::Move bestMove = DarkChess::MOVE_NULL;
+  int bestScore = 0;
+  DarkChess::Color Us = DarkChess::COLOR_NONE;
+  std::chrono::time_point<std::chrono::system_clock> start;
+
+  Limits limits;
+  uint64_t nodes = 0;  // nodes visited by the current search
+  uint64_t evalProbes = 0, evalHits = 0; // eval cache use in the current search
+  uint64_t tbHits = 0;
+  int depth = 0;       // last completed iteration
+  bool stopped = false;
+
+  // Root moves scored exactly, up to multiPV of them; the first is the
+  // best move. Every finished iteration writes them to info if it is set.
+  int multiPV = 1;
+  std::vector<Line> lines;
+  FILE* info = nullptr;
+
+  // Every random choice of the search draws from here, so a seeded
+  // search under a node limit is exactly reproducible
+  std::minstd_rand rng;
+  uint64_t totalNodes = 0;
+  uint64_t signature = 0xCBF29CE484222325ULL; // digest of nodes and best move of every search
+
+  // Principal variation of the last search, and the position it expects
+  // after our move and the reply; the next search starts from its third
+  // move if that position comes up
+  std::vector<DarkChess::Move> pv;
+  uint64_t pvKey = 0;
+
+  // Determinized search: the pieces assumed under the dark squares, which
+  // turns flips into ordinary moves, and the keys of those pieces on the
+  // squares still dark, mixed into the TT keys so different
+  // determinizations keep apart
+  const DarkChess::Piece* hidden = nullptr;
+  uint64_t keyMix = 0;
+};
 
-extern DarkChess::Move _bestMove;
-extern int _bestScore;
-extern DarkChess::Color Us;
 extern Trans::TranspTable tt;
 
-void iterDeep(DarkChess::Board initialBoard);
-void rootMax(DarkChess::Board &board, int depth);
-int negaScout(DarkChess::Board &board, int depth, int alpha, int beta);
+void iterDeep(Context &ctx, DarkChess::Board initialBoard);
+// Perfect-information Monte Carlo: searches `samples` random assignments
+// of the hidden pieces on `threads` workers and plays the move most of
+// them prefer
+void pimc(Context &ctx, const DarkChess::Board &board, int samples, int threads);
+// Copies to out the TT entries of the positions nearest board, up to max
+// of them, and returns how many
+size_t hot_entries(const Context &ctx, const DarkChess::Board &board, Trans::TranspTable::Saved* out, size_t max);
+void rootMax(Context &ctx, DarkChess::Board &board, int depth);
+int negaScout(Context &ctx, DarkChess::Board &board, int depth, int alpha, int beta);
 
 } // namespace Search
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include "server.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace Server {
+
+namespace {
+
+std::mutex mtx;
+std::condition_variable cv;
+std::unordered_map<int, std::shared_ptr<Session>> sessions;
+std::deque<std::shared_ptr<Session>> runQueue;
+bool closing = false;
+
+std::mutex outMtx;
+
+void worker() {
+  char read[1024], output[1024];
+
+  for (;;) {
+    std::shared_ptr<Session> s;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      cv.wait(lock, [] { return closing || !runQueue.empty(); });
+      if (runQueue.empty()) return;
+      s = runQueue.front();
+      runQueue.pop_front();
+      strncpy(read, s->pending.front().c_str(), sizeof(read) - 1);
+      read[sizeof(read) - 1] = '\0';
+      s->pending.pop_front();
+    }
+
+    output[0] = '\0';
+    int id = s->engine.execute(read, output);
+    {
+      std::lock_guard<std::mutex> lock(outMtx);
+      fprintf(stdout, "%d %s", s->id, output);
+      fflush(stdout);
+    }
+
+    // Go to the back of the queue so every session gets its turn
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!s->pending.empty()) {
+      runQueue.push_back(s);
+      cv.notify_one();
+    } else {
+      s->scheduled = false;
+      if (id == QUIT) sessions.erase(s->id);
+    }
+  }
+}
+
+} // namespace
+
+int run(int threads, const Search::Limits &limits) {
+  std::vector<std::thread> pool;
+  for (int i = 0; i < threads; i++) {
+    pool.emplace_back(worker);
+  }
+
+  char read[1024];
+  while (fgets(read, sizeof(read), stdin) != NULL) {
+    int sid, n;
+    read[strcspn(read, "\n")] = '\0';
+    if (sscanf(read, "%d %n", &sid, &n) != 1 || read[n] == '\0') {
+      fprintf(stderr, "bad frame: %s\n", read);
+      continue;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    std::shared_ptr<Session> &s = sessions[sid];
+    if (!s) s = std::make_shared<Session>(sid, limits);
+    s->pending.push_back(read + n);
+    if (!s->scheduled) {
+      s->scheduled = true;
+      runQueue.push_back(s);
+      cv.notify_one();
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    closing = true;
+  }
+  cv.notify_all();
+  for (auto &t : pool) t.join();
+  return 0;
+}
+
+} // namespace Server
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <deque>
+#include <string>
+
+#include "engine.h"
+
+/*
+ * Server mode: many games multiplexed over one stdin/stdout pair.
+ *
+ * Every input line is framed as "session id command args", where the part
+ * after the session number is the usual single-game protocol. Replies are
+ * written as "session =id ..." once the command has run. A session is
+ * created the first time its number is seen and dropped after "quit".
+ *
+ * The lookup tables and the transposition table are shared by all games;
+ * each session keeps its own Board and search context. A fixed pool of
+ * workers takes sessions round-robin, one command at a time, so a long
+ * genmove never starves the other games.
+ */
+namespace Server {
+
+struct Session {
+  Session(int _id, const Search::Limits &limits) : id(_id), scheduled(false) {
+    engine.set_verbose(false);
+    engine.set_limits(limits);
+  }
+
+  int id;
+  Engine engine;
+  std::deque<std::string> pending; // commands not yet executed
+  bool scheduled;                  // queued for, or held by, a worker
+};
+
+int run(int threads, const Search::Limits &limits);
+
+} // namespace Server
@@ -1,17 +1,28 @@
 #include "state.h"
+#include "evalcache.h"
 
 namespace DarkChess {
 
 uint64_t hashArray[SQUARE_NB][PIECE_NB+1];
 uint64_t hashTurn;
+uint64_t hashPool[PIECE_NB][6];
+uint64_t hashSym[SYMMETRY_NB][SQUARE_NB][PIECE_NB+1];
+bool symmetricHashing = false;
+EvalCache evalCache;
+thread_local EvalCache::Stats EvalCache::stats;
 
 Board::Board(int seed) : rng(seed) {
-  // Initialize magic bitboard
-  initCannonMasks();
-  initCannonMagicTable();
-
-  init_hash();
-  init_distance();
+  // The lookup tables are shared by every board in the process,
+  // fill them once no matter how many games are running
+  static std::once_flag tablesReady;
+  std::call_once(tablesReady, [this]() {
+    // Initialize magic bitboard
+    initCannonMasks();
+    initCannonMagicTable();
+
+    init_hash();
+    init_distance();
+  });
 }
 
 void Board::clear_bitboards() {
@@ -40,19 +51,23 @@ void Board::clear_bitboards() {
     }
   }
 
+  aScore[RED] = aScore[BLACK] = 0;
   hash_ = 0;
+  for (int t = 0; t < SYMMETRY_NB; t++) symHash[t] = 0;
+  Nnue::reset(accumulator);
   repetition = 0;
   noCaptureFlipMoves = 0;
-  history = {};
+  historyHead = historySize = 0;
 }
 
 void Board::init_hash() {
+  // One key per square for every piece and for dark, by get_piece index
   for (Square s = SQ_A1; s < SQUARE_NB; ++s) {
-    for (Piece p = R_PAWN; p <= PIECE_DARK; ++p) {
-      hashArray[s][get_piece(p)] = 0;
+    for (int i = 0; i <= PIECE_NB; i++) {
+      hashArray[s][i] = 0;
       for (int k = 0; k < 64; ++k) {
         if ((rng() / (RAND_MAX + 1.0)) > 0.5) {
-          hashArray[s][get_piece(p)] |= (1ULL << k);
+          hashArray[s][i] |= (1ULL << k);
         }
       }
     }
@@ -64,6 +79,55 @@ void Board::init_hash() {
       hashTurn |= (1ULL << k);
     }
   }
+
+  for (int t = 0; t < SYMMETRY_NB; t++) {
+    for (Square s = SQ_A1; s < SQUARE_NB; ++s) {
+      for (Color c = RED; c < COLOR_NB; ++c) {
+        for (PieceType pt = PAWN; pt <= KING; ++pt) {
+          Piece p = make_piece(c, pt);
+          hashSym[t][s][get_piece(p)] = hashArray[mirror(s, t)][get_piece(mirror(p, t))];
+        }
+      }
+      hashSym[t][s][get_piece(PIECE_DARK)] = hashArray[mirror(s, t)][get_piece(PIECE_DARK)];
+    }
+  }
+
+  for (int p = 0; p < PIECE_NB; p++) {
+    for (int n = 0; n < 6; n++) {
+      hashPool[p][n] = 0;
+      for (int k = 0; k < 64; k++) {
+        if ((rng() / (RAND_MAX + 1.0)) > 0.5) {
+          hashPool[p][n] |= (1ULL << k);
+        }
+      }
+    }
+  }
+}
+
+// Everything not revealed on the board counts as hidden. A position set up
+// from a FEN has no record of captures, so its captured pieces are assumed
+// to still be in the pool.
+void Board::reset_pool() {
+  int counts[PIECE_NB];
+  for (Color c = RED; c < COLOR_NB; ++c) {
+    for (PieceType pt = PAWN; pt <= KING; ++pt) {
+      int k = get_piece(c, pt);
+      counts[k] = std::max(0, PieceTotal[pt] - pieceCount[k]);
+    }
+  }
+  set_pool(counts);
+}
+
+void Board::set_pool(const int counts[PIECE_NB]) {
+  poolKey[0] = poolKey[1] = 0;
+  for (Color c = RED; c < COLOR_NB; ++c) {
+    for (PieceType pt = PAWN; pt <= KING; ++pt) {
+      Piece p = make_piece(c, pt);
+      int n = hidden[get_piece(p)] = counts[get_piece(p)];
+      poolKey[0] ^= hashPool[get_piece(p)][n];
+      poolKey[1] ^= hashPool[get_piece(mirror(p, SYM_COLOR))][n];
+    }
+  }
 }
 
 void Board::init() {
@@ -77,7 +141,8 @@ void Board::init() {
     put_piece(PIECE_DARK, s);
   }
 
-  history.push(hash_);
+  reset_pool();
+  update_history();
 }
 
 void Board::set_from_FEN(std::string FEN) {
@@ -85,12 +150,17 @@ void Board::set_from_FEN(std::string FEN) {
   std::string token;
   
   clear_bitboards();
+  sideToMove = COLOR_NONE;
+  status_ = Status::RedPlay;
 
   //std::cerr << "After clear bitboards\n";
   //std::cerr << std::bitset<32>(pieces(EMPTY)) << std::endl;
   Square s = SQ_A8; // Fen string starts at a8 = index 28
   fenStream >> token;
   for (auto curChar : token) {
+    if (curChar != '/' && !isdigit(curChar) && !is_ok(s)) {
+      throw std::invalid_argument("FEN describes more than 32 squares");
+    }
     switch(curChar) {
       case 'p': put_piece(make_piece(RED, PAWN), s);
                 ++s; break;
@@ -124,7 +194,10 @@ void Board::set_from_FEN(std::string FEN) {
                 ++s; break;
       case '/': s -= Square(8); // Go down one rank
                 break;
-      default: s += Square(curChar - '0');
+      default: if (!isdigit(curChar)) {
+                 throw std::invalid_argument("unknown FEN character");
+               }
+               s += Square(curChar - '0');
     }
   }
 
@@ -135,10 +208,78 @@ void Board::set_from_FEN(std::string FEN) {
   } else if (token == "b") {
     sideToMove = BLACK;
     status_ = Status::BlackPlay;
+    hash_ ^= hashTurn;
   }
 
   fenStream >> token;
   gameLength = stoi(token);
+
+  reset_pool();
+  update_material_score(RED);
+  update_material_score(BLACK);
+  update_history();
+}
+
+// Sets up a position directly from its square contents, with no move history
+void Board::set_from_array(const Piece pcs[SQUARE_NB], Color stm) {
+  clear_bitboards();
+  for (Square s = SQ_A1; s < SQUARE_NB; ++s) {
+    if (pcs[s] != NO_PIECE) {
+      put_piece(pcs[s], s);
+    }
+  }
+
+  sideToMove = stm;
+  status_ = stm == BLACK ? Status::BlackPlay : Status::RedPlay;
+  if (stm == BLACK) hash_ ^= hashTurn;
+  gameLength = 0;
+  reset_pool();
+
+  update_material_score(RED);
+  update_material_score(BLACK);
+  update_history();
+}
+
+Snapshot Board::snapshot() const {
+  Snapshot snap = {};
+  for (Square s = SQ_A1; s < SQUARE_NB; ++s) {
+    snap.squares[s / 2] |= get_piece(board[s]) << (4 * (s & 1));
+  }
+  for (int k = 0; k < PIECE_NB; k++) snap.pool |= uint64_t(hidden[k]) << (3 * k);
+  snap.gameLength = gameLength;
+  snap.sideToMove = sideToMove;
+  snap.noCaptureFlipMoves = noCaptureFlipMoves;
+  return snap;
+}
+
+void Board::restore(const Snapshot &snap) {
+  int counts[PIECE_NB];
+  for (int k = 0; k < PIECE_NB; k++) {
+    counts[k] = (snap.pool >> (3 * k)) & 7;
+    if (counts[k] > PieceTotal[type_of(piece_of_index(k))]) {
+      throw std::invalid_argument("snapshot pool holds too many pieces");
+    }
+  }
+  if (snap.sideToMove > COLOR_NONE) {
+    throw std::invalid_argument("snapshot side to move is not a colour");
+  }
+
+  clear_bitboards();
+  for (Square s = SQ_A1; s < SQUARE_NB; ++s) {
+    Piece pc = piece_of_index((snap.squares[s / 2] >> (4 * (s & 1))) & 15);
+    if (pc != NO_PIECE) put_piece(pc, s);
+  }
+
+  sideToMove = Color(snap.sideToMove);
+  status_ = sideToMove == BLACK ? Status::BlackPlay : Status::RedPlay;
+  if (sideToMove == BLACK) hash_ ^= hashTurn;
+  gameLength = snap.gameLength;
+  noCaptureFlipMoves = snap.noCaptureFlipMoves;
+  set_pool(counts);
+
+  update_material_score(RED);
+  update_material_score(BLACK);
+  update_history();
 }
 
 template <Color Us>
@@ -237,12 +378,13 @@ int Board::legal_flip_actions(MoveList &mL, int idx) {
   return idx;
 }
 
+// The last 4 hashes, in a ring so copying a board never allocates
 void Board::update_history() {
-  if (history.size() == 4) {
-    history.pop();
-    history.push(hash_);
+  if (historySize == 4) {
+    history[historyHead] = hash_;
+    historyHead = (historyHead + 1) % 4;
   } else {
-    history.push(hash_);
+    history[(historyHead + historySize++) % 4] = hash_;
   }
 }
 
@@ -253,10 +395,18 @@ void Board::flip_move(Move m, Piece p, Color c) {
       assert(board[s] == PIECE_DARK);
       remove_piece(PIECE_DARK, s);
       put_piece(p, s);
+      int k = get_piece(p), j = get_piece(mirror(p, SYM_COLOR));
+      if (k < PIECE_NB && hidden[k] > 0) {
+        int n = hidden[k]--;
+        poolKey[0] ^= hashPool[k][n] ^ hashPool[k][n - 1];
+        poolKey[1] ^= hashPool[j][n] ^ hashPool[j][n - 1];
+      }
 
       // first flip determines player's color
+      // hashTurn is set whenever black is to move
       if (sideToMove == COLOR_NONE) {
         sideToMove = c;
+        if (c == BLACK) hash_ ^= hashTurn;
       }
       sideToMove = ~sideToMove;
       hash_ ^= hashTurn;
@@ -311,7 +461,7 @@ void Board::do_move(Move m, Piece &captured) {
   sideToMove = ~sideToMove;
   hash_ ^= hashTurn;
   gameLength++;
-  if (hash_ == history.front()) repetition += 1;
+  if (historySize > 0 && hash_ == history[historyHead]) repetition += 1;
   else repetition = 0;
   
   update_history();
@@ -389,6 +539,56 @@ std::minstd_rand Board::getRng() const { return rng; }
 
 uint64_t Board::getHash() const { return hash_; }
 
+uint64_t Board::getPoolKey(bool swapped) const { return poolKey[swapped]; }
+
+// Whether the image under symmetry t of a position with stm to move has
+// black to move
+static inline bool black_in_image(Color stm, int t) {
+  return stm != COLOR_NONE && (stm == BLACK) != bool(t & SYM_COLOR);
+}
+
+// The canonical image among the piece hashes h of a position's images:
+// the smallest, with red to move winning a tie. The TT, book and eval
+// cache keys all take this one.
+static int canonical_sym(const uint64_t h[SYMMETRY_NB], Color stm) {
+  int sym = 0;
+  for (int t = 1; t < SYMMETRY_NB; t++) {
+    if (h[t] < h[sym] || (h[t] == h[sym] && black_in_image(stm, sym) && !black_in_image(stm, t))) sym = t;
+  }
+  return sym;
+}
+
+uint64_t Board::canonical_hash(int &sym) const {
+  sym = canonical_sym(symHash, sideToMove);
+  return black_in_image(sideToMove, sym) ? symHash[sym] ^ hashTurn : symHash[sym];
+}
+
+uint64_t Board::hash_after(Move m, bool canonical) const {
+  Square from = from_sq(m), to = to_sq(m);
+  Piece pc = board[from], cap = board[to];
+  if (!canonical) {
+    uint64_t h = hash_ ^ hashTurn ^ hashArray[from][get_piece(pc)] ^ hashArray[to][get_piece(pc)];
+    return cap != NO_PIECE ? h ^ hashArray[to][get_piece(cap)] : h;
+  }
+  // As canonical_hash, with the other side to move
+  uint64_t h[SYMMETRY_NB];
+  for (int t = 0; t < SYMMETRY_NB; t++) h[t] = sym_hash_after(t, from, to, pc, cap);
+  int sym = canonical_sym(h, ~sideToMove);
+  return black_in_image(~sideToMove, sym) ? h[sym] ^ hashTurn : h[sym];
+}
+
+uint64_t Board::eval_key_after(Move m) const {
+  Square from = from_sq(m), to = to_sq(m);
+  Piece pc = board[from], cap = board[to];
+  if (!symmetricHashing) {
+    uint64_t h = hash_after(m, false);
+    return sideToMove == RED ? h ^ hashTurn : h;
+  }
+  uint64_t best = sym_hash_after(0, from, to, pc, cap);
+  for (int t = 1; t < SYMMETRY_NB; t++) best = std::min(best, sym_hash_after(t, from, to, pc, cap));
+  return best;
+}
+
 int Board::getRepetition() const { return repetition; }
 
 int Board::getNoCFMoves() const { return noCaptureFlipMoves; }
@@ -411,13 +611,14 @@ void Board::update_status(int legalMoves) {
 
 void Board::update_basic_value(Color Us) {
   Color Op = ~Us;
-  BV[get_piece(Us, PAWN)] = 1 + 4 * popCount(pieces(Op, KING)) + popCount(pieces(Op, PAWN));
-  BV[get_piece(Us, KNIGHT)] = 1 + 4 * popCount(pieces(Op, PAWN)) + popCount(pieces(Op, CANNON, KNIGHT));
-  BV[get_piece(Us, ROOK)] = 1 + 4 * popCount(pieces(Op, KNIGHT, PAWN)) + popCount(pieces(Op, ROOK, CANNON));
-  BV[get_piece(Us, MINISTER)] = 1 + 4 * popCount(pieces(Op, ROOK, KNIGHT, PAWN)) + popCount(pieces(Op, MINISTER, CANNON));
-  BV[get_piece(Us, GUARD)] = 1 + 4 * popCount(pieces(Op, MINISTER, ROOK, KNIGHT, PAWN)) + popCount(pieces(Op, GUARD, CANNON));
-  BV[get_piece(Us, KING)] = 1 + 4 * popCount(pieces(Op, GUARD, MINISTER, ROOK, KNIGHT)) + popCount(pieces(Op, CANNON, KING));
-  BV[get_piece(Us, CANNON)] = 4 * popCount(pieces(Op)) + popCount(pieces(Op));
+  const int base = EvalParams::BvBase, prey = EvalParams::BvPrey, peer = EvalParams::BvPeer;
+  BV[get_piece(Us, PAWN)] = base + prey * popCount(pieces(Op, KING)) + peer * popCount(pieces(Op, PAWN));
+  BV[get_piece(Us, KNIGHT)] = base + prey * popCount(pieces(Op, PAWN)) + peer * popCount(pieces(Op, CANNON, KNIGHT));
+  BV[get_piece(Us, ROOK)] = base + prey * popCount(pieces(Op, KNIGHT, PAWN)) + peer * popCount(pieces(Op, ROOK, CANNON));
+  BV[get_piece(Us, MINISTER)] = base + prey * popCount(pieces(Op, ROOK, KNIGHT, PAWN)) + peer * popCount(pieces(Op, MINISTER, CANNON));
+  BV[get_piece(Us, GUARD)] = base + prey * popCount(pieces(Op, MINISTER, ROOK, KNIGHT, PAWN)) + peer * popCount(pieces(Op, GUARD, CANNON));
+  BV[get_piece(Us, KING)] = base + prey * popCount(pieces(Op, GUARD, MINISTER, ROOK, KNIGHT)) + peer * popCount(pieces(Op, CANNON, KING));
+  BV[get_piece(Us, CANNON)] = prey * popCount(pieces(Op)) + peer * popCount(pieces(Op));
 }
 
 void Board::update_material_score(Color Us) {
@@ -506,6 +707,10 @@ int Board::num_of_dark_pieces() const {
   return popCount(pieces(DARK));
 }
 
+int Board::num_of_pieces() const {
+  return popCount(pieces(ALL_PIECES));
+}
+
 int Board::get_score(Color c) const {
   return score[c];// + aScore[c];
 }
@@ -518,6 +723,10 @@ bool Board::is_dark(Square s) const {
   return board[s] == PIECE_DARK;
 }
 
+int Board::get_hidden(Piece p) const {
+  return hidden[get_piece(p)];
+}
+
 /*
  * The evaluation function must be sensitive to the sideToMove
  * For a position with MAX node to move, return score
@@ -526,8 +735,24 @@ bool Board::is_dark(Square s) const {
 int Board::evaluate(Color Us) const {
   //std::cout << "Evaluate...\n";
   //std::cout << "sideToMove " << Us << std::endl;
-  Color Op = ~Us;
-  int score = get_score(Us) - get_score(Op) + aScore[Us];
+  // The material score only depends on the pieces, look it up without
+  // the side to move so both turns share the cached entry
+  uint64_t key = sideToMove == BLACK ? hash_ ^ hashTurn : hash_;
+  int sign = 1;
+  if (symmetricHashing) {
+    // A colour-swapped image has the opposite score for red
+    int sym = canonical_sym(symHash, sideToMove);
+    key = symHash[sym];
+    sign = sym & SYM_COLOR ? -1 : 1;
+  }
+  int redScore;
+  if (evalCache.probe(key, redScore)) {
+    redScore *= sign;
+  } else {
+    redScore = Nnue::enabled() ? Nnue::evaluate(accumulator) : get_score(RED) - get_score(BLACK);
+    evalCache.store(key, sign * redScore);
+  }
+  int score = (Us == RED ? redScore : -redScore) + aScore[Us];
   if (Us != sideToMove) {
     return -score;
   }
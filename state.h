@@ -6,15 +6,38 @@
 #include <ctype.h>
 #include <random>
 #include <string.h>
-#include <queue>
+#include <mutex>
 #include <bitset>
+#include <stdexcept>
 
 #include "types.h"
 #include "magic.h"
 #include "move_ordering.h"
+#include "nnue.h"
 
 namespace DarkChess {
 
+// Hash positions by their canonical symmetric form in the TT and eval cache
+extern bool symmetricHashing;
+
+/*
+ * A position in 32 bytes, for caches, files and other processes. The
+ * squares are 4-bit get_piece codes, two to a byte with the lower square
+ * in the low nibble, 128 bits in all; the header holds the hidden pool at
+ * 3 bits per piece by get_piece code, the side to move and the counters.
+ * The repetition history starts over on restore, as after set_from_FEN.
+ */
+struct Snapshot {
+  uint8_t squares[SQUARE_NB / 2];
+  uint64_t pool;
+  uint16_t gameLength;
+  uint8_t sideToMove;
+  uint8_t noCaptureFlipMoves;
+  uint8_t reserved[4];
+};
+
+static_assert(sizeof(Snapshot) == 32, "snapshots are stored as raw 32-byte blocks");
+
 class Board {
   public:
     Board(int seed = 9);
@@ -22,6 +45,10 @@ class Board {
     void init_hash();
     void init();
     void set_from_FEN(std::string FEN);
+    void set_from_array(const Piece pcs[SQUARE_NB], Color stm);
+    Snapshot snapshot() const;
+    // Throws std::invalid_argument on a side or pool no game can reach
+    void restore(const Snapshot &snap);
 
     template <Color Us> int legal_normal_actions(MoveList &mL, ScoreList &sL, int idx);
     Bitboard CGen(Bitboard src);
@@ -38,12 +65,29 @@ class Board {
     int get_gameLength() const;
     std::minstd_rand getRng() const;
     uint64_t getHash() const;
+    uint64_t getPoolKey(bool swapped = false) const;
+    // Hash of the canonical image over the board's symmetries, the one
+    // with the smallest piece hash; sym is set to the one that maps this
+    // board onto it
+    uint64_t canonical_hash(int &sym) const;
+    // Hash, canonical if asked, and eval cache key of the position after
+    // the normal move m, from the key deltas without making the move
+    uint64_t hash_after(Move m, bool canonical) const;
+    uint64_t eval_key_after(Move m) const;
     int getRepetition() const;
     int getNoCFMoves() const;
     int get_score(Color c) const;
     int get_pieceCount(Piece p) const;
     bool is_dark(Square s) const;
+    int get_hidden(Piece p) const;
+
+    inline Piece piece_on(Square s) const {
+      return board[s];
+    }
 
+    void reset_pool();
+    // Hidden pieces by get_piece index, for positions whose captures are known
+    void set_pool(const int counts[PIECE_NB]);
     void update_status(int legalMoves);
     void update_history();
     void update_basic_value(Color Us);
@@ -53,6 +97,8 @@ class Board {
     bool is_terminal() const;
     Color who_won() const;
     int num_of_dark_pieces() const;
+    int num_of_pieces() const;
+    int num_of_pieces(Color c) const { return popCount(pieces(c)); }
     int evaluate(Color Us) const;
 
     std::string print_move(Move m) const;
@@ -62,13 +108,19 @@ class Board {
   private:
     std::minstd_rand rng;
     uint64_t hash_;
-    std::queue<uint64_t> history;
+    uint64_t history[4];
+    int historyHead; // oldest entry
+    int historySize;
     int repetition;
     int noCaptureFlipMoves;
     Color sideToMove;
     Status status_;
     int gameLength;
     int pieceCount[PIECE_NB+2]; // + PIECE_DARK, NO_PIECE
+    int hidden[PIECE_NB]; // pieces not flipped yet
+    uint64_t poolKey[2]; // hashPool of the hidden counts, as is and colour-swapped
+    uint64_t symHash[SYMMETRY_NB]; // piece part of the hash of every mirror image
+    Nnue::Accumulator accumulator; // first network layer, kept only with a network loaded
     Piece board[SQUARE_NB];
     Bitboard byTypeBB[PIECE_TYPE_NB]; // 0-6, 7: Dark, 8: Empty, 9: ALL_PIECES
     Bitboard byColorBB[COLOR_NB+1]; // RED, BLACK, DARK
@@ -78,6 +130,12 @@ class Board {
     int MV[PIECE_NB]; // Material Value
     int TV[PIECE_NB][PIECE_NB]; // Threat Value
 
+    // symHash[t] after moving pc from `from` to `to` over cap
+    inline uint64_t sym_hash_after(int t, Square from, Square to, Piece pc, Piece cap) const {
+      uint64_t h = symHash[t] ^ hashSym[t][from][get_piece(pc)] ^ hashSym[t][to][get_piece(pc)];
+      return cap != NO_PIECE ? h ^ hashSym[t][to][get_piece(cap)] : h;
+    }
+
     inline Bitboard pieces(Color c) const {
       return byColorBB[c];
     }
@@ -102,10 +160,6 @@ class Board {
       return byColorBB[c] & (byTypeBB[pt1] | byTypeBB[pt2] | byTypeBB[pt3] | byTypeBB[pt4]);
     }
 
-    inline Piece piece_on(Square s) const {
-      return board[s];
-    }
-
     inline void move_piece(Piece pc, Square from, Square to) {
       Bitboard fromTo = (1UL << from) | (1UL << to);
       byTypeBB[ALL_PIECES] ^= fromTo;
@@ -115,6 +169,10 @@ class Board {
       board[to] = pc;
       hash_ ^= hashArray[from][get_piece(pc)];
       hash_ ^= hashArray[to][get_piece(pc)];
+      for (int t = 0; t < SYMMETRY_NB; t++) {
+        symHash[t] ^= hashSym[t][from][get_piece(pc)] ^ hashSym[t][to][get_piece(pc)];
+      }
+      if (Nnue::enabled()) Nnue::move(accumulator, from, to, pc);
     }
 
     inline void put_piece(Piece pc, Square s) {
@@ -126,6 +184,10 @@ class Board {
       byColorBB[color_of(pc)] ^= mask;
       pieceCount[get_piece(pc)]++;
       hash_ ^= hashArray[s][get_piece(pc)];
+      for (int t = 0; t < SYMMETRY_NB; t++) {
+        symHash[t] ^= hashSym[t][s][get_piece(pc)];
+      }
+      if (Nnue::enabled()) Nnue::add(accumulator, s, pc);
       //std::cerr << std::bitset<32>(mask) << std::endl;
       //std::cerr << std::bitset<32>(byTypeBB[EMPTY]) << std::endl;
     }
@@ -140,6 +202,10 @@ class Board {
       pieceCount[get_piece(pc)]--;
       if (pc != NO_PIECE) {
         hash_ ^= hashArray[s][get_piece(pc)];
+        for (int t = 0; t < SYMMETRY_NB; t++) {
+          symHash[t] ^= hashSym[t][s][get_piece(pc)];
+        }
+        if (Nnue::enabled()) Nnue::remove(accumulator, s, pc);
       }
       //std::cerr << std::bitset<32>(mask) << std::endl;
       //std::cerr << std::bitset<32>(byTypeBB[EMPTY]) << std::endl;
@@ -0,0 +1,768 @@
+#include "tablebase.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <dirent.h>
+#include <fcntl.h>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include <zlib.h>
+
+#include "memory.h"
+
+using namespace DarkChess;
+
+namespace Tablebase {
+
+namespace {
+
+const int MaxCount[KING + 1] = {5, 2, 2, 2, 2, 2, 1};
+// Order of the pieces of one side inside an index, strongest first
+const PieceType Order[KING + 1] = {KING, GUARD, MINISTER, ROOK, KNIGHT, CANNON, PAWN};
+
+const char Magic[4] = {'C', 'D', 'T', 'B'};
+const uint32_t Version = 2;
+
+struct Material {
+  int count[COLOR_NB][KING + 1];
+
+  int size(Color c) const {
+    int n = 0;
+    for (PieceType pt = PAWN; pt <= KING; ++pt) n += count[c][pt];
+    return n;
+  }
+
+  int size() const { return size(RED) + size(BLACK); }
+
+  // 3 bits per piece type and colour
+  uint64_t key() const {
+    uint64_t k = 0;
+    for (Color c = RED; c < COLOR_NB; ++c) {
+      for (PieceType pt = PAWN; pt <= KING; ++pt) {
+        k = (k << 3) | count[c][pt];
+      }
+    }
+    return k;
+  }
+
+  static Material from_key(uint64_t k) {
+    Material m;
+    for (Color c = BLACK; c >= RED; c = Color(c - 1)) {
+      for (PieceType pt = KING; pt >= PAWN; pt = PieceType(pt - 1)) {
+        m.count[c][pt] = k & 7;
+        k >>= 3;
+      }
+    }
+    return m;
+  }
+
+  // Tables are stored with the stronger side as red: more pieces first,
+  // then the better pieces
+  bool canonical() const {
+    if (size(RED) != size(BLACK)) return size(RED) > size(BLACK);
+    for (PieceType pt : Order) {
+      if (count[RED][pt] != count[BLACK][pt]) return count[RED][pt] > count[BLACK][pt];
+    }
+    return true;
+  }
+
+  Material swapped() const {
+    Material m;
+    for (PieceType pt = PAWN; pt <= KING; ++pt) {
+      m.count[RED][pt] = count[BLACK][pt];
+      m.count[BLACK][pt] = count[RED][pt];
+    }
+    return m;
+  }
+
+  std::string name() const {
+    const char letters[KING + 1] = {'p', 'c', 'n', 'r', 'm', 'g', 'k'};
+    std::string s;
+    for (Color c = RED; c < COLOR_NB; ++c) {
+      if (c == BLACK) s += 'v';
+      for (PieceType pt : Order) {
+        for (int i = 0; i < count[c][pt]; i++) {
+          s += c == RED ? letters[pt] : char(toupper(letters[pt]));
+        }
+      }
+    }
+    return s;
+  }
+};
+
+// File layout: this header, the file offset of every block and one past
+// the last, then the blocks. A block holds BlockSize distances (+1, 0 for
+// draws and unused indices), deflated with zlib.
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint64_t size;      // indices
+  uint32_t blockSize; // indices per block
+  uint32_t blocks;
+};
+
+const uint32_t BlockSize = 4096;
+const int CacheSlots = 64;
+
+struct Table {
+  Material material;
+  int pieces;
+  Piece slots[SQUARE_NB];        // piece of each index slot
+  int start[PIECE_NB];           // first slot of each piece, by get_piece()
+  const uint8_t* file = nullptr; // whole file, mapped read-only
+  const uint64_t* offsets = nullptr;
+  uint64_t size = 0;
+  const uint8_t* raw = nullptr;  // uncompressed copy kept by the generator
+};
+
+std::unordered_map<uint64_t, Table> tables;
+int maxPieces = 0;
+
+// Blocks decompressed by this thread, direct-mapped by table and block
+struct CachedBlock {
+  const Table* table;
+  uint64_t block;
+  uint8_t data[BlockSize];
+};
+
+thread_local std::unique_ptr<CachedBlock[]> cache;
+
+void decompress(const Table &tb, uint64_t block, uint8_t* out) {
+  uLongf n = std::min(uint64_t(BlockSize), tb.size - block * BlockSize);
+  const uint8_t* src = tb.file + tb.offsets[block];
+  uLong len = tb.offsets[block + 1] - tb.offsets[block];
+  // A damaged block reads as draws
+  if (uncompress(out, &n, src, len) != Z_OK) std::fill(out, out + BlockSize, 0);
+}
+
+// Stored value of index idx: distance + 1, 0 for draws
+uint8_t value(const Table &tb, uint64_t idx) {
+  if (tb.raw) return tb.raw[idx];
+  if (!cache) {
+    cache.reset(new CachedBlock[CacheSlots]);
+    for (int i = 0; i < CacheSlots; i++) cache[i].table = nullptr;
+  }
+  uint64_t block = idx / BlockSize;
+  CachedBlock &c = cache[(block + tb.material.key() * 0x9E3779B97F4A7C15ULL) % CacheSlots];
+  if (c.table != &tb || c.block != block) {
+    decompress(tb, block, c.data);
+    c.table = &tb;
+    c.block = block;
+  }
+  return c.data[idx % BlockSize];
+}
+
+// A concrete position as seen by the generator
+struct Position {
+  Piece board[SQUARE_NB];
+  Color stm;
+};
+
+// 8 squares for the first piece, 32 for every other one, 2 sides to move
+uint64_t table_size(int pieces) {
+  return uint64_t(8 * 2) << (5 * (pieces - 1));
+}
+
+void init_table(Table &tb, const Material &m) {
+  tb.material = m;
+  tb.pieces = 0;
+  for (Color c = RED; c < COLOR_NB; ++c) {
+    for (PieceType pt : Order) {
+      Piece p = make_piece(c, pt);
+      tb.start[get_piece(p)] = tb.pieces;
+      for (int i = 0; i < m.count[c][pt]; i++) {
+        tb.slots[tb.pieces++] = p;
+      }
+    }
+  }
+}
+
+Material material_of(const Position &pos) {
+  Material m = {};
+  for (Square s = SQ_A1; s < SQUARE_NB; ++s) {
+    Piece p = pos.board[s];
+    if (p != NO_PIECE) m.count[color_of(p)][type_of(p)]++;
+  }
+  return m;
+}
+
+// Index of pos in tb, exchanging colours first if swapped. Of the four
+// mirror images the one with the smallest square sequence is used; that
+// always puts the first piece in files a-b, ranks 1-4. Identical pieces
+// are kept in square order so a position has a single index.
+uint64_t encode(const Position &pos, const Table &tb, bool swapped) {
+  Square best[SQUARE_NB], cur[SQUARE_NB];
+  int n = tb.pieces;
+
+  for (int t = 0; t < 4; t++) {
+    int used[PIECE_NB] = {0};
+    for (Square s = SQ_A1; s < SQUARE_NB; ++s) {
+      Piece p = pos.board[s];
+      if (p == NO_PIECE) continue;
+      int k = get_piece(mirror(p, swapped ? SYM_COLOR : 0));
+      cur[tb.start[k] + used[k]++] = mirror(s, t);
+    }
+    for (int i = 0; i < n; ) {
+      int j = i + 1;
+      while (j < n && tb.slots[j] == tb.slots[i]) j++;
+      std::sort(cur + i, cur + j);
+      i = j;
+    }
+    if (t == 0 || std::lexicographical_compare(cur, cur + n, best, best + n)) {
+      std::copy(cur, cur + n, best);
+    }
+  }
+
+  uint64_t idx = rank_of(best[0]) * 2 + file_of(best[0]);
+  for (int i = 1; i < n; i++) {
+    idx = idx * 32 + best[i];
+  }
+  Color stm = swapped ? ~pos.stm : pos.stm;
+  return idx * 2 + stm;
+}
+
+// Inverse of encode; false if two pieces would share a square
+bool decode(uint64_t idx, const Table &tb, Position &pos) {
+  Square sq[SQUARE_NB];
+  pos.stm = Color(idx & 1);
+  idx >>= 1;
+  for (int i = tb.pieces - 1; i > 0; i--) {
+    sq[i] = Square(idx & 31);
+    idx >>= 5;
+  }
+  sq[0] = make_square(File(idx & 1), Rank(idx >> 1));
+
+  std::fill(pos.board, pos.board + SQUARE_NB, NO_PIECE);
+  for (int i = 0; i < tb.pieces; i++) {
+    if (pos.board[sq[i]] != NO_PIECE) return false;
+    pos.board[sq[i]] = tb.slots[i];
+  }
+  return true;
+}
+
+const Table* find(const Position &pos, bool &swapped) {
+  Material m = material_of(pos);
+  swapped = !m.canonical();
+  auto it = tables.find(swapped ? m.swapped().key() : m.key());
+  return it == tables.end() ? nullptr : &it->second;
+}
+
+// Generation state of a position
+enum State { UNKNOWN, WON, LOST, UNUSED };
+
+const int MaxDist = 254;
+const uint64_t SliceSize = 1 << 14;
+const double CheckpointInterval = 30;
+
+const char WipMagic[4] = {'C', 'D', 'W', 'P'};
+
+// A table being built. Every position has two bits of state and one bit
+// in each frontier set (settled in the previous iteration, settled in the
+// current one); the distances go straight into the memory-mapped output
+// file, which the kernel writes back as it sees fit.
+struct Builder {
+  Table &tb;
+  uint64_t size;
+  Memory::Array<std::atomic<uint64_t>> state, fresh, next;
+  uint8_t* dist;
+  std::atomic<int> maxSeed; // largest distance recorded ahead of its iteration
+  std::atomic<uint64_t> settled;
+  int d;                    // iteration: positions settled now are d plies from the end
+
+  Builder(Table &t) : tb(t), size(table_size(t.pieces)), dist(nullptr), maxSeed(0), settled(0), d(0) {
+    state = Memory::make_array<std::atomic<uint64_t>>(words(2 * size));
+    fresh = Memory::make_array<std::atomic<uint64_t>>(words(size));
+    next = Memory::make_array<std::atomic<uint64_t>>(words(size));
+  }
+
+  static uint64_t words(uint64_t bits) { return (bits + 63) / 64; }
+
+  static void clear(Memory::Array<std::atomic<uint64_t>> &bits, uint64_t n) {
+    for (uint64_t i = 0; i < words(n); i++) bits[i].store(0, std::memory_order_relaxed);
+  }
+};
+
+State get_state(const Builder &b, uint64_t i) {
+  uint64_t w = b.state[i / 32].load(std::memory_order_relaxed);
+  return State((w >> (i % 32 * 2)) & 3);
+}
+
+// Decides i at the current distance; false if it was already decided.
+// Odd distances are wins for the side to move, even ones losses.
+bool settle(Builder &b, uint64_t i) {
+  std::atomic<uint64_t> &w = b.state[i / 32];
+  int shift = i % 32 * 2;
+  uint64_t old = w.load(std::memory_order_relaxed);
+  uint64_t bits = uint64_t(b.d % 2 ? WON : LOST) << shift;
+  do {
+    if ((old >> shift) & 3) return false;
+  } while (!w.compare_exchange_weak(old, old | bits, std::memory_order_relaxed));
+
+  __atomic_store_n(&b.dist[i], uint8_t(b.d + 1), __ATOMIC_RELAXED);
+  b.next[i / 64].fetch_or(1ULL << (i % 64), std::memory_order_relaxed);
+  return true;
+}
+
+// Records that i is decided at distance d, for iteration d to pick up
+void seed(Builder &b, uint64_t i, int d) {
+  d = std::min(d, MaxDist);
+  __atomic_store_n(&b.dist[i], uint8_t(d + 1), __ATOMIC_RELAXED);
+  int m = b.maxSeed.load(std::memory_order_relaxed);
+  while (m < d && !b.maxSeed.compare_exchange_weak(m, d, std::memory_order_relaxed)) {}
+}
+
+// Value of the position reached by m as distance + 1. After a capture it
+// comes from the smaller table; otherwise only the state is known, and a
+// position settled before iteration d is at most d - 1 plies from the end.
+int child_value(const Builder &b, const Position &pos, Move m) {
+  Position child = pos;
+  Square from = from_sq(m), to = to_sq(m);
+  Piece captured = child.board[to];
+  child.board[to] = child.board[from];
+  child.board[from] = NO_PIECE;
+  child.stm = ~pos.stm;
+
+  if (captured == NO_PIECE) {
+    State s = get_state(b, encode(child, b.tb, false));
+    if ((s != WON && s != LOST) || b.d == 0) return 0;
+    int d = b.d - 1;
+    if (d % 2 != (s == WON)) d--;
+    return d + 1;
+  }
+  // The opponent just lost their last piece
+  if (b.tb.material.size(color_of(captured)) == 1) {
+    return 1;
+  }
+  bool swapped;
+  const Table* sub = find(child, swapped);
+  assert(sub);
+  return value(*sub, encode(child, *sub, swapped));
+}
+
+struct Scan {
+  int moves;    // legal moves
+  int winDist;  // shortest win through a child lost for the opponent, 0 if none
+  bool allLose; // every child is won by the opponent
+  int lossDist; // longest of those wins + 1
+};
+
+// Move generation goes through the engine's own rules, so the tables
+// agree with what the search considers legal
+void scan(Board &board, const Builder &b, const Position &pos, Scan &out) {
+  MoveList mList;
+  ScoreList sList;
+  board.set_from_array(pos.board, pos.stm);
+  out.moves = board.get_legal_moves(mList, sList);
+  out.winDist = 0;
+  out.allLose = true;
+  out.lossDist = 0;
+
+  for (int i = 0; i < out.moves; i++) {
+    int v = child_value(b, pos, mList[i]);
+    if (v == 0) {
+      out.allLose = false;
+    } else if ((v - 1) % 2 == 0) {
+      if (out.winDist == 0 || v < out.winDist) out.winDist = v;
+      out.allLose = false;
+    } else {
+      out.lossDist = std::max(out.lossDist, v);
+    }
+  }
+}
+
+// Positions of the same material from which the side that just moved
+// reached pos with a normal move. Normal moves go one step to an empty
+// square, so they are their own inverse.
+int predecessors(Board &board, const Position &pos, Position out[]) {
+  MoveList mList;
+  ScoreList sList;
+  board.set_from_array(pos.board, ~pos.stm);
+  int size = board.get_legal_moves(mList, sList);
+  int n = 0;
+
+  for (int i = 0; i < size; i++) {
+    Square from = from_sq(mList[i]), to = to_sq(mList[i]);
+    if (pos.board[to] != NO_PIECE) continue;
+    Position &q = out[n++];
+    q = pos;
+    q.board[to] = q.board[from];
+    q.board[from] = NO_PIECE;
+    q.stm = ~pos.stm;
+  }
+  return n;
+}
+
+// Runs fn(board, first, last) over slices of [0, size); each thread keeps
+// taking the next slice nobody has started yet
+template <class F>
+void parallel_for(uint64_t size, int threads, F fn) {
+  std::atomic<uint64_t> cursor(0);
+  auto work = [&]() {
+    Board board;
+    for (uint64_t lo; (lo = cursor.fetch_add(SliceSize)) < size; ) {
+      fn(board, lo, std::min(lo + SliceSize, size));
+    }
+  };
+  std::vector<std::thread> pool;
+  for (int i = 1; i < threads; i++) pool.emplace_back(work);
+  work();
+  for (auto &t : pool) t.join();
+}
+
+// Marks the unused indices and records the distance of every position
+// decided by having no move or by its captures
+void seed_all(Builder &b, int threads) {
+  parallel_for(b.size, threads, [&](Board &board, uint64_t lo, uint64_t hi) {
+    Position pos;
+    Scan sc;
+    for (uint64_t i = lo; i < hi; i++) {
+      if (!decode(i, b.tb, pos) || encode(pos, b.tb, false) != i) {
+        b.state[i / 32].fetch_or(uint64_t(UNUSED) << (i % 32 * 2), std::memory_order_relaxed);
+        continue;
+      }
+      scan(board, b, pos, sc);
+      if (sc.moves == 0) {
+        seed(b, i, 0);
+      } else if (sc.winDist) {
+        seed(b, i, sc.winDist);
+      } else if (sc.allLose) {
+        seed(b, i, sc.lossDist);
+      }
+    }
+  });
+}
+
+// Settles every position exactly b.d plies from the end. Wins and losses
+// alternate between iterations, so what this iteration settles never
+// changes the outcome of another check in the same iteration.
+void iterate(Builder &b, int threads) {
+  // Distances recorded in advance
+  if (b.d <= b.maxSeed) {
+    parallel_for(b.size, threads, [&](Board &, uint64_t lo, uint64_t hi) {
+      uint64_t n = 0;
+      for (uint64_t i = lo; i < hi; i++) {
+        if (__atomic_load_n(&b.dist[i], __ATOMIC_RELAXED) == b.d + 1 && get_state(b, i) == UNKNOWN) {
+          n += settle(b, i);
+        }
+      }
+      b.settled += n;
+    });
+  }
+  if (b.d == 0) return;
+
+  // Predecessors of the positions settled by the previous iteration
+  parallel_for(b.size, threads, [&](Board &board, uint64_t lo, uint64_t hi) {
+    Position pos, prev[MAX_MOVES];
+    Scan sc;
+    uint64_t n = 0;
+    for (uint64_t w = lo / 64; w < (hi + 63) / 64; w++) {
+      for (uint64_t bits = b.fresh[w].load(std::memory_order_relaxed); bits; bits &= bits - 1) {
+        decode(w * 64 + __builtin_ctzll(bits), b.tb, pos);
+        int k = predecessors(board, pos, prev);
+        for (int j = 0; j < k; j++) {
+          uint64_t q = encode(prev[j], b.tb, false);
+          if (get_state(b, q) != UNKNOWN) continue;
+          if (b.d % 2) {
+            // Moving into a lost position wins
+            n += settle(b, q);
+            continue;
+          }
+          // Lost once every move leads to a win for the opponent; a
+          // capture may still postpone that to a later iteration
+          scan(board, b, prev[j], sc);
+          if (!sc.allLose || sc.lossDist == 0) continue;
+          if (sc.lossDist <= b.d) {
+            n += settle(b, q);
+          } else {
+            seed(b, q, sc.lossDist);
+          }
+        }
+      }
+    }
+    b.settled += n;
+  });
+}
+
+// Saves the state and frontier so an interrupted build can go on from
+// the next iteration. The distances are flushed first, so the file on
+// disk is never older than the checkpoint describing it.
+bool checkpoint(const std::string &path, Builder &b, void* map, size_t mapSize) {
+  if (msync(map, mapSize, MS_SYNC) != 0) return false;
+
+  std::string tmp = path + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (!f) return false;
+  uint64_t key = b.tb.material.key();
+  int32_t iter = b.d, maxSeed = b.maxSeed;
+  bool ok = fwrite(WipMagic, 4, 1, f) == 1
+         && fwrite(&key, sizeof(key), 1, f) == 1
+         && fwrite(&iter, sizeof(iter), 1, f) == 1
+         && fwrite(&maxSeed, sizeof(maxSeed), 1, f) == 1;
+  // std::atomic<uint64_t> has the layout of uint64_t
+  uint64_t n = Builder::words(2 * b.size), m = Builder::words(b.size);
+  ok = ok && fwrite(b.state.get(), sizeof(uint64_t), n, f) == n
+          && fwrite(b.fresh.get(), sizeof(uint64_t), m, f) == m
+          && fflush(f) == 0 && fsync(fileno(f)) == 0;
+  ok = fclose(f) == 0 && ok;
+  return ok && rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool restore(const std::string &path, Builder &b) {
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f) return false;
+  char magic[4];
+  uint64_t key;
+  int32_t iter, maxSeed;
+  uint64_t n = Builder::words(2 * b.size), m = Builder::words(b.size);
+  bool ok = fread(magic, 4, 1, f) == 1 && !memcmp(magic, WipMagic, 4)
+         && fread(&key, sizeof(key), 1, f) == 1 && key == b.tb.material.key()
+         && fread(&iter, sizeof(iter), 1, f) == 1
+         && fread(&maxSeed, sizeof(maxSeed), 1, f) == 1
+         && fread(b.state.get(), sizeof(uint64_t), n, f) == n
+         && fread(b.fresh.get(), sizeof(uint64_t), m, f) == m;
+  fclose(f);
+  if (ok) {
+    b.d = iter;
+    b.maxSeed = maxSeed;
+  } else {
+    Builder::clear(b.state, 2 * b.size);
+    Builder::clear(b.fresh, b.size);
+  }
+  return ok;
+}
+
+// Writes the distances in data to path in the block-compressed format,
+// through a temporary file so a reader never sees half a table
+bool compress(const std::string &path, const Table &tb, const uint8_t* data, uint64_t size) {
+  Header h;
+  memcpy(h.magic, Magic, 4);
+  h.version = Version;
+  h.key = tb.material.key();
+  h.size = size;
+  h.blockSize = BlockSize;
+  h.blocks = (size + BlockSize - 1) / BlockSize;
+  std::vector<uint64_t> offsets(h.blocks + 1);
+  offsets[0] = sizeof(h) + offsets.size() * sizeof(uint64_t);
+
+  std::string tmp = path + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (!f) return false;
+  bool ok = fseek(f, offsets[0], SEEK_SET) == 0;
+  std::vector<uint8_t> buf(compressBound(BlockSize));
+  for (uint32_t b = 0; b < h.blocks && ok; b++) {
+    uint64_t i = uint64_t(b) * BlockSize;
+    uLongf len = buf.size();
+    ok = compress2(buf.data(), &len, data + i, std::min(uint64_t(BlockSize), size - i), 9) == Z_OK
+      && fwrite(buf.data(), 1, len, f) == len;
+    offsets[b + 1] = offsets[b] + len;
+  }
+  ok = ok && fseek(f, 0, SEEK_SET) == 0
+          && fwrite(&h, sizeof(h), 1, f) == 1
+          && fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), f) == offsets.size()
+          && fflush(f) == 0 && fsync(fileno(f)) == 0;
+  ok = fclose(f) == 0 && ok;
+  return ok && rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+// Retrograde analysis of one material set into dir, one level of
+// distance at a time. All smaller tables reachable by a capture must
+// already be loaded. The distances are built in a ".part" file next to a
+// ".wip" checkpoint and compressed into place once complete; the
+// uncompressed mapping is returned in raw for the larger tables to use.
+bool build(const std::string &dir, Table &tb, int threads, const uint8_t* &raw) {
+  std::string path = dir + "/" + tb.material.name();
+  std::string part = path + ".part", wip = path + ".wip";
+  Builder b(tb);
+
+  int fd = open(part.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) return false;
+  struct stat st;
+  bool resume = fstat(fd, &st) == 0 && uint64_t(st.st_size) == b.size && restore(wip, b);
+  if (!resume && (ftruncate(fd, 0) != 0 || ftruncate(fd, b.size) != 0)) {
+    close(fd);
+    return false;
+  }
+  void* map = mmap(NULL, b.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return false;
+  b.dist = static_cast<uint8_t*>(map);
+
+  if (resume) {
+    fprintf(stderr, "resuming %s at iteration %d\n", tb.material.name().c_str(), b.d);
+  } else {
+    seed_all(b, threads);
+  }
+
+  bool ok = true;
+  auto saved = std::chrono::steady_clock::now();
+  for (bool done = false; !done && ok; ) {
+    b.settled = 0;
+    iterate(b, threads);
+    std::swap(b.fresh, b.next);
+    Builder::clear(b.next, b.size);
+    done = (b.settled == 0 && b.d >= b.maxSeed) || b.d == MaxDist;
+    b.d++;
+
+    std::chrono::duration<double> since = std::chrono::steady_clock::now() - saved;
+    if (!done && since.count() >= CheckpointInterval) {
+      ok = checkpoint(wip, b, map, b.size);
+      saved = std::chrono::steady_clock::now();
+    }
+  }
+
+  ok = ok && compress(path + ".cdtb", tb, b.dist, b.size);
+  if (!ok) {
+    munmap(map, b.size);
+    return false;
+  }
+  // The mapping outlives the file
+  unlink(part.c_str());
+  unlink(wip.c_str());
+  raw = b.dist;
+  fprintf(stderr, "generated %s (%d iterations)\n", tb.material.name().c_str(), b.d);
+  return true;
+}
+
+// Maps a table file. Only the header and the block index are read, so
+// opening a table costs little whatever its size, and every process
+// probing the file shares its pages. decompress trusts the index, so it
+// must start right after itself, never go backwards and end at the end
+// of the file.
+bool load_file(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  void* map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && size_t(st.st_size) > sizeof(Header)) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) return false;
+
+  const Header* h = static_cast<const Header*>(map);
+  const uint64_t* offsets = reinterpret_cast<const uint64_t*>(h + 1);
+  Table tb;
+  bool ok = !memcmp(h->magic, Magic, 4) && h->version == Version && h->blockSize == BlockSize;
+  if (ok) {
+    init_table(tb, Material::from_key(h->key));
+    uint64_t indexEnd = sizeof(Header) + (uint64_t(h->blocks) + 1) * sizeof(uint64_t);
+    ok = h->size == table_size(tb.pieces)
+      && h->blocks == (h->size + BlockSize - 1) / BlockSize
+      && uint64_t(st.st_size) >= indexEnd
+      && offsets[0] == indexEnd
+      && offsets[h->blocks] == uint64_t(st.st_size);
+    for (uint64_t b = 0; ok && b < h->blocks; b++) ok = offsets[b] <= offsets[b + 1];
+  }
+  if (!ok) {
+    munmap(map, st.st_size);
+    return false;
+  }
+  madvise(map, st.st_size, MADV_RANDOM);
+
+  // Tables stay mapped for the life of the process
+  tb.file = static_cast<const uint8_t*>(map);
+  tb.offsets = offsets;
+  tb.size = h->size;
+  maxPieces = std::max(maxPieces, tb.pieces);
+  tables[h->key] = tb;
+  return true;
+}
+
+// All piece sets of one side with exactly n pieces
+void side_sets(int n, PieceType pt, int count[KING + 1], std::vector<std::vector<int>> &out) {
+  if (pt > KING) {
+    if (n == 0) out.push_back(std::vector<int>(count, count + KING + 1));
+    return;
+  }
+  for (int k = 0; k <= std::min(n, MaxCount[pt]); k++) {
+    count[pt] = k;
+    side_sets(n - k, PieceType(pt + 1), count, out);
+  }
+  count[pt] = 0;
+}
+
+} // namespace
+
+bool generate(const std::string &dir, int pieces, int threads) {
+  for (int n = 2; n <= pieces; n++) {
+    for (int red = n - 1; red >= 1; red--) {
+      std::vector<std::vector<int>> redSets, blackSets;
+      int count[KING + 1] = {0};
+      side_sets(red, PAWN, count, redSets);
+      side_sets(n - red, PAWN, count, blackSets);
+
+      for (auto &r : redSets) {
+        for (auto &b : blackSets) {
+          Material m;
+          std::copy(r.begin(), r.end(), m.count[RED]);
+          std::copy(b.begin(), b.end(), m.count[BLACK]);
+          std::string file = dir + "/" + m.name() + ".cdtb";
+          if (!m.canonical() || tables.count(m.key()) || load_file(file)) continue;
+
+          Table tb;
+          const uint8_t* raw;
+          init_table(tb, m);
+          if (!build(dir, tb, threads, raw) || !load_file(file)) {
+            fprintf(stderr, "cannot write table %s\n", m.name().c_str());
+            return false;
+          }
+          tables[m.key()].raw = raw;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+int load(const std::string &dir) {
+  DIR* d = opendir(dir.c_str());
+  if (!d) return 0;
+  int n = 0;
+  while (struct dirent* e = readdir(d)) {
+    std::string file = e->d_name;
+    if (file.size() > 5 && file.compare(file.size() - 5, 5, ".cdtb") == 0) {
+      n += load_file(dir + "/" + file);
+    }
+  }
+  closedir(d);
+  return n;
+}
+
+int max_pieces() {
+  return maxPieces;
+}
+
+bool probe(const Board &board, Result &result) {
+  if (board.num_of_pieces() > maxPieces || board.num_of_dark_pieces() > 0
+      || board.side_to_move() == COLOR_NONE) {
+    return false;
+  }
+
+  Position pos;
+  for (Square s = SQ_A1; s < SQUARE_NB; ++s) {
+    pos.board[s] = board.piece_on(s);
+  }
+  pos.stm = board.side_to_move();
+
+  bool swapped;
+  const Table* tb = find(pos, swapped);
+  if (!tb) return false;
+
+  int v = value(*tb, encode(pos, *tb, swapped));
+  if (v == 0) {
+    result = {0, 0};
+  } else {
+    result.distance = v - 1;
+    result.wdl = result.distance % 2 ? 1 : -1;
+  }
+  return true;
+}
+
+} // namespace Tablebase
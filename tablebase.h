@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+
+#include "state.h"
+
+/*
+ * Endgame tablebases for fully revealed positions.
+ *
+ * Once no piece is dark the game has perfect information. For every
+ * material set of up to a few pieces the generator computes, by retrograde
+ * analysis, whether the side to move wins, loses or draws, and in how many
+ * plies the loser runs out of pieces or moves (the 60-move rule is not
+ * taken into account).
+ *
+ * A position is indexed by its piece squares, reduced by the board's
+ * symmetries: the left-right and top-bottom mirrors (the first piece is
+ * always brought into files a-b, ranks 1-4) and the colour swap (the
+ * stronger side is always stored as red).
+ *
+ * Table files are split into zlib-compressed blocks behind a small index
+ * and are memory-mapped, so loading does not depend on their size and
+ * engines on one machine share the pages. A probe inflates only the block
+ * it touches, into a small cache owned by the probing thread.
+ */
+namespace Tablebase {
+
+struct Result {
+  int wdl;      // 1 win, 0 draw, -1 loss for the side to move
+  int distance; // plies until the losing side has no piece or move left
+};
+
+// Builds every table with up to maxPieces pieces in dir on the given
+// number of threads, reusing files that already exist there. A build that
+// was interrupted resumes from its last checkpoint. Returns false if a
+// file cannot be written.
+bool generate(const std::string &dir, int maxPieces, int threads = 1);
+
+// Loads all tables found in dir and returns how many were read
+int load(const std::string &dir);
+
+// Largest piece count covered by the loaded tables, 0 if none
+int max_pieces();
+
+// Looks up a position without dark pieces; false if no table covers it
+bool probe(const DarkChess::Board &board, Result &result);
+
+} // namespace Tablebase
@@ -0,0 +1,163 @@
+#include "training.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace DarkChess;
+
+namespace Training {
+
+namespace {
+
+const int RandomPlies = 8;   // random actions opening every game
+const int MaxPlies = 600;    // games this long are scored as draws
+const uint64_t DefaultNodes = 2000;
+const size_t ChunkRecords = 1 << 16;
+
+// Pieces under the dark squares, shuffled like the referee deals them
+void deal(std::mt19937_64 &rng, Piece pieces[SQUARE_NB]) {
+  int n = 0;
+  for (Color c = RED; c < COLOR_NB; ++c) {
+    for (PieceType pt = PAWN; pt <= KING; ++pt) {
+      for (int i = 0; i < PieceTotal[pt]; i++) pieces[n++] = make_piece(c, pt);
+    }
+  }
+  for (int i = SQUARE_NB - 1; i > 0; i--) {
+    std::swap(pieces[i], pieces[rng() % (i + 1)]);
+  }
+}
+
+// Plays one game and appends its searched positions to records; returns
+// the result from red's side
+int play(Board &board, Search::Context &ctx, std::mt19937_64 &rng, std::vector<Record> &records) {
+  Piece dealt[SQUARE_NB];
+  deal(rng, dealt);
+  board.init();
+  ctx.pv.clear();
+  int alive[COLOR_NB] = {16, 16};
+
+  for (int ply = 0; ply < MaxPlies; ply++) {
+    Color us = board.side_to_move();
+    MoveList mList;
+    ScoreList sList;
+    Move m = MOVE_NULL;
+    if (ply < RandomPlies || us == COLOR_NONE) {
+      int size = board.get_legal_moves(mList, sList);
+      size = board.legal_flip_actions(mList, size);
+      if (size) m = mList[rng() % size];
+    } else {
+      Search::iterDeep(ctx, board);
+      m = ctx.bestMove;
+      if (m != MOVE_NULL) {
+        int eval = us == RED ? ctx.bestScore : -ctx.bestScore;
+        records.push_back(pack(board, std::max(-EvalLimit, std::min(EvalLimit, eval))));
+      }
+    }
+    if (m == MOVE_NULL) return us == RED ? -1 : 1;
+
+    if (from_sq(m) == to_sq(m)) {
+      Piece p = dealt[from_sq(m)];
+      board.flip_move(m, p, color_of(p));
+      if (us == COLOR_NONE) us = color_of(p);
+    } else {
+      Piece captured;
+      board.do_move(m, captured);
+      if (captured != NO_PIECE) alive[color_of(captured)]--;
+    }
+
+    // The referee's rules, applied to the side now to move
+    Color them = ~us;
+    if (alive[them] == 0) return us == RED ? 1 : -1;
+    if (board.get_legal_moves(mList, sList) == 0 && board.num_of_dark_pieces() == 0) {
+      return us == RED ? 1 : -1;
+    }
+    if (board.getNoCFMoves() >= 60 || board.getRepetition() >= 9) return 0;
+  }
+  return 0;
+}
+
+} // namespace
+
+Record pack(const Board &board, int eval) {
+  Snapshot snap = board.snapshot();
+  Record r = {};
+  memcpy(r.squares, snap.squares, sizeof(r.squares));
+  r.pool = snap.pool;
+  r.eval = eval;
+  r.ply = snap.gameLength;
+  r.stm = snap.sideToMove;
+  return r;
+}
+
+void unpack(const Record &r, Board &board) {
+  Snapshot snap = {};
+  memcpy(snap.squares, r.squares, sizeof(snap.squares));
+  snap.pool = r.pool;
+  snap.gameLength = r.ply;
+  snap.sideToMove = r.stm;
+  board.restore(snap);
+}
+
+bool generate(const std::string &out, uint64_t positions, int threads,
+              const Search::Limits &limits, unsigned seed) {
+  FILE* f = fopen(out.c_str(), "ab");
+  if (!f) return false;
+
+  Search::Limits searchLimits = limits;
+  searchLimits.time = 0;
+  if (searchLimits.depth == 0 && searchLimits.nodes == 0) searchLimits.nodes = DefaultNodes;
+
+  std::mutex mtx;
+  std::atomic<uint64_t> written(0);
+  std::atomic<uint64_t> games(0);
+  bool failed = false;
+  auto start = std::chrono::steady_clock::now();
+
+  auto flush = [&](std::vector<Record> &buffer) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!failed && fwrite(buffer.data(), sizeof(Record), buffer.size(), f) != buffer.size()) {
+      failed = true;
+    }
+    uint64_t total = written += buffer.size();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    fprintf(stderr, "%llu positions, %llu games, %.0f positions/s\n", (unsigned long long)total,
+            (unsigned long long)games.load(), total / std::max(elapsed.count(), 1e-3));
+    buffer.clear();
+  };
+
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; t++) {
+    pool.emplace_back([&, t]() {
+      Board board;
+      Search::Context ctx;
+      ctx.limits = searchLimits;
+      ctx.rng.seed(seed + t);
+      std::mt19937_64 rng(seed * 0x9E3779B97F4A7C15ULL + t);
+      std::vector<Record> buffer, game;
+      buffer.reserve(ChunkRecords + MaxPlies);
+
+      // Threads only see each other's flushed chunks, so the file may end
+      // up to a chunk per thread past the goal
+      while (written + buffer.size() < positions) {
+        game.clear();
+        int result = play(board, ctx, rng, game);
+        for (Record &r : game) r.result = result;
+        buffer.insert(buffer.end(), game.begin(), game.end());
+        games++;
+        if (buffer.size() >= ChunkRecords) flush(buffer);
+      }
+      if (!buffer.empty()) flush(buffer);
+    });
+  }
+  for (auto &t : pool) t.join();
+
+  return fclose(f) == 0 && !failed;
+}
+
+} // namespace Training
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "search.h"
+
+/*
+ * Training data from self-play.
+ *
+ * Every position is stored as a fixed 32-byte record, so a data file is a
+ * plain array that can be memory-mapped, split or shuffled without parsing:
+ *   squares  the squares of the board's Snapshot: 4-bit get_piece codes,
+ *            0-13 a piece, 14 dark, 15 empty
+ *   pool     the Snapshot pool, 3 bits per piece still hidden
+ *   eval     search score from red's side, clamped to +-EvalLimit
+ *   ply      game length when the position came up
+ *   stm      side to move
+ *   result   1 red won, 0 draw, -1 black won
+ *
+ * The generator plays games on several threads, each against its own
+ * search context and the shared transposition table. The first plies are
+ * random actions so the games spread out; after that both sides play
+ * the search's move and every position is recorded with its score. The
+ * records of a game get its result once it ends, and each thread hands
+ * them to the output file in large chunks.
+ */
+namespace Training {
+
+const int EvalLimit = 32000;
+
+struct Record {
+  uint8_t squares[DarkChess::SQUARE_NB / 2];
+  uint64_t pool;
+  int16_t eval;
+  uint16_t ply;
+  uint8_t stm;
+  int8_t result;
+  uint16_t reserved;
+};
+
+static_assert(sizeof(Record) == 32, "records are written as raw 32-byte blocks");
+
+// Record of the board with red's score; the result is left at 0
+Record pack(const DarkChess::Board &board, int eval);
+
+// Sets up the board of a record, pool included
+void unpack(const Record &r, DarkChess::Board &board);
+
+// Appends at least `positions` records to out, searching every move with
+// limits (a node limit if none is given). Returns false on an I/O error.
+bool generate(const std::string &out, uint64_t positions, int threads,
+              const Search::Limits &limits, unsigned seed);
+
+} // namespace Training
@@ -1,7 +1,10 @@
 #pragma once
 
 #include "types.h"
-#include <unordered_map>
+#include "memory.h"
+#include <atomic>
+#include <memory>
+#include <string>
 
 using namespace DarkChess;
 
@@ -14,6 +17,7 @@ enum Flag {
 };
 
 struct TTEntry {
+  TTEntry() = default;
   TTEntry(int _score, int _depth, DarkChess::Move _bestMove, Flag _flag)
     : score(_score), depth(_depth), bestMove(_bestMove), flag(_flag) {}
 
@@ -23,31 +27,158 @@ struct TTEntry {
   Flag flag;
 };
 
+/*
+ * Fixed-size table shared by every search running in the process, and
+ * after share() by every process on the machine that names the same
+ * shared memory object. A slot stores its key XORed with the packed data,
+ * so a slot torn by two threads or processes writing at once fails the key
+ * check instead of returning a mismatched entry.
+ *
+ * Slots come in pairs. Entries are stamped with the generation of the
+ * search that wrote them; a new position takes the slot of its pair left
+ * by an older search, else the shallower one, so what the last move's
+ * search learnt stays around for the next one until it is outgrown. Each
+ * process counts its own generations, so entries of the other processes
+ * are the first to make room.
+ */
 class TranspTable {
   public:
-    TranspTable() = default;
+    static const size_t DEFAULT_MB = 64;
+
+    TranspTable(size_t mb = DEFAULT_MB) { resize(mb); }
+
+    void resize(size_t mb) {
+      size_t count = slots(mb);
+      table.reset();
+      table = Memory::make_array<Slot>(count);
+      mask = count - 1;
+    }
+
+    // Moves the table into the shared memory object name, which every
+    // process naming it uses as one table. Its size is fixed by whichever
+    // process creates it, with mb megabytes; false if it cannot be mapped
+    // or has a size no table has.
+    bool share(const std::string &name, size_t mb) {
+      size_t bytes = slots(mb) * sizeof(Slot);
+      void* p = Memory::map_shared(name, bytes);
+      if (!p) return false;
+      size_t count = bytes / sizeof(Slot);
+      if (bytes % sizeof(Slot) || (count & (count - 1)) || count < 2) {
+        Memory::release(p, bytes);
+        return false;
+      }
+      table.reset();
+      table = Memory::Array<Slot>(static_cast<Slot*>(p), Memory::Deleter(bytes));
+      mask = count - 1;
+      return true;
+    }
+
+    // Called once per search; entries of earlier searches age
+    void new_search() {
+      generation.store((generation.load(std::memory_order_relaxed) + 1) & GEN_MASK, std::memory_order_relaxed);
+    }
+
     void set(uint64_t Zkey, TTEntry entry) {
-      auto insertResult = table.emplace(Zkey, entry);
+      unsigned gen = generation.load(std::memory_order_relaxed);
+      uint64_t data = pack(entry, gen);
+      Slot* bucket = &table[Zkey & mask & ~uint64_t(1)];
+      Slot* slot = nullptr;
+      int worst = 0;
+      for (int i = 0; i < 2; i++) {
+        uint64_t d = bucket[i].data.load(std::memory_order_relaxed);
+        if ((bucket[i].key.load(std::memory_order_relaxed) ^ d) == Zkey) {
+          slot = &bucket[i];
+          break;
+        }
+        int value = int((d >> 32) & 0xFF) + (unsigned(d >> 53 & GEN_MASK) == gen ? 256 : 0);
+        if (!slot || value < worst) {
+          slot = &bucket[i];
+          worst = value;
+        }
+      }
+      slot->key.store(Zkey ^ data, std::memory_order_relaxed);
+      slot->data.store(data, std::memory_order_relaxed);
+    }
 
-      // If key already exist, overwrite the value
-      if (!insertResult.second) {
-        insertResult.first->second = entry;
+    bool probe(const uint64_t Zkey, TTEntry &entry) const {
+      const Slot* bucket = &table[Zkey & mask & ~uint64_t(1)];
+      for (int i = 0; i < 2; i++) {
+        uint64_t data = bucket[i].data.load(std::memory_order_relaxed);
+        if ((bucket[i].key.load(std::memory_order_relaxed) ^ data) == Zkey) {
+          entry = unpack(data);
+          return true;
+        }
       }
+      return false;
     }
 
-    const TTEntry *getEntry(const uint64_t Zkey) {
-      auto got = table.find(Zkey);
-      if (got != table.end()) {
-        return &table.at(Zkey);
-      } else {
-        return nullptr;
+    // A slot as stored, for saving the table outside the process
+    struct Saved {
+      uint64_t key;
+      uint64_t data;
+    };
+
+    // Copies the slot holding Zkey to out, as probe finds it
+    bool save(const uint64_t Zkey, Saved &out) const {
+      const Slot* bucket = &table[Zkey & mask & ~uint64_t(1)];
+      for (int i = 0; i < 2; i++) {
+        uint64_t data = bucket[i].data.load(std::memory_order_relaxed);
+        if ((bucket[i].key.load(std::memory_order_relaxed) ^ data) == Zkey) {
+          out = {Zkey, data};
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void load(const Saved* in, size_t n) {
+      for (size_t i = 0; i < n; i++) set(in[i].key, unpack(in[i].data));
+    }
+
+    // Starts loading the bucket of Zkey into the cache
+    void prefetch(uint64_t Zkey) const {
+      __builtin_prefetch(&table[Zkey & mask & ~uint64_t(1)]);
+    }
+
+    void clear() {
+      for (uint64_t i = 0; i <= mask; i++) {
+        table[i].key.store(0, std::memory_order_relaxed);
+        table[i].data.store(0, std::memory_order_relaxed);
       }
     }
-    
-    void clear() { table.clear(); }
 
   private:
-    std::unordered_map<uint64_t, TTEntry> table;
+    struct Slot {
+      std::atomic<uint64_t> key;
+      std::atomic<uint64_t> data;
+    };
+
+    static const unsigned GEN_MASK = 0x3F;
+
+    static size_t slots(size_t mb) {
+      size_t count = 2;
+      while (count * 2 * sizeof(Slot) <= mb * 1024 * 1024) count *= 2;
+      return count;
+    }
+
+    // score: 32 bits, depth: 8 bits, flag: 2 bits, move: 11 bits, generation: 6 bits
+    static uint64_t pack(const TTEntry &e, unsigned gen) {
+      int depth = e.depth < 0 ? 0 : (e.depth > 255 ? 255 : e.depth);
+      return uint64_t(uint32_t(e.score))
+           | (uint64_t(depth) << 32)
+           | (uint64_t(e.flag) << 40)
+           | (uint64_t(e.bestMove & 0x7FF) << 42)
+           | (uint64_t(gen) << 53);
+    }
+
+    static TTEntry unpack(uint64_t data) {
+      return TTEntry(int(uint32_t(data)), int((data >> 32) & 0xFF),
+                     DarkChess::Move((data >> 42) & 0x7FF), Flag((data >> 40) & 0x3));
+    }
+
+    Memory::Array<Slot> table;
+    uint64_t mask;
+    std::atomic<unsigned> generation{0};
 };
 
 } // namespace Trans
\ No newline at end of file
@@ -0,0 +1,300 @@
+#include "tuner.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "training.h"
+
+using namespace DarkChess;
+
+namespace Tuner {
+
+namespace {
+
+const int TYPES = KING + 1;
+const int MULTS = 3;                // BvBase, BvPrey, BvPeer
+const int FEATURES = TYPES * MULTS;
+const int Block = 256;              // positions per inner pass, a multiple of Lanes
+const int Lanes = 8;
+const int Epochs = 400;
+const int RefitEpochs = 200;
+const double LearningRate = 0.02;
+
+inline unsigned bit(PieceType pt) { return 1u << pt; }
+const unsigned All = (1u << TYPES) - 1;
+
+// update_basic_value: the opponent pieces counted by prey and peer for
+// the basic value of each piece type
+const unsigned PreyOf[TYPES] = {
+  bit(KING), All, bit(PAWN), bit(KNIGHT) | bit(PAWN), bit(ROOK) | bit(KNIGHT) | bit(PAWN),
+  bit(MINISTER) | bit(ROOK) | bit(KNIGHT) | bit(PAWN), bit(GUARD) | bit(MINISTER) | bit(ROOK) | bit(KNIGHT)
+};
+const unsigned PeerOf[TYPES] = {
+  bit(PAWN), All, bit(CANNON) | bit(KNIGHT), bit(ROOK) | bit(CANNON), bit(MINISTER) | bit(CANNON),
+  bit(GUARD) | bit(CANNON), bit(CANNON) | bit(KING)
+};
+// update_material_score: the pieces whose basic values a piece type sums
+const unsigned Victims[TYPES] = {
+  bit(PAWN) | bit(KING), All, bit(PAWN) | bit(CANNON) | bit(KNIGHT), All & ~(bit(MINISTER) | bit(GUARD) | bit(KING)),
+  All & ~(bit(GUARD) | bit(KING)), All & ~bit(KING), All & ~bit(PAWN)
+};
+
+struct Params {
+  double value[TYPES];
+  double mult[MULTS];
+};
+
+// Columns of the dataset, padded with neutral positions to whole blocks
+struct Dataset {
+  size_t size = 0;
+  std::vector<float> feature[FEATURES];
+  std::vector<float> target;
+};
+
+Params current() {
+  namespace E = EvalParams;
+  Params p = {{E::PawnValue, E::CannonValue, E::KnightValue, E::RookValue, E::MinisterValue, E::GuardValue,
+               E::KingValue}, {E::BvBase, E::BvPrey, E::BvPeer}};
+  return p;
+}
+
+int sum_of(const int n[TYPES], unsigned set) {
+  int s = 0;
+  for (int pt = 0; pt < TYPES; pt++) {
+    if (set & (1u << pt)) s += n[pt];
+  }
+  return s;
+}
+
+// Red's material features of a record: the score is the sum over piece
+// types and multipliers of value * multiplier * feature
+void features(const Training::Record &r, float out[FEATURES]) {
+  int n[COLOR_NB][TYPES] = {};
+  for (Square s = SQ_A1; s < SQUARE_NB; ++s) {
+    int code = (r.squares[s / 2] >> (4 * (s & 1))) & 15;
+    if (code < PIECE_NB) n[code / TYPES][code % TYPES]++;
+  }
+  std::fill(out, out + FEATURES, 0.0f);
+  for (Color us = RED; us < COLOR_NB; ++us) {
+    // The basic values of the opponent's pieces come from our counts
+    int bv[TYPES][MULTS];
+    for (int v = 0; v < TYPES; v++) {
+      bv[v][0] = v != CANNON;
+      bv[v][1] = sum_of(n[us], PreyOf[v]);
+      bv[v][2] = sum_of(n[us], PeerOf[v]);
+    }
+    int sign = us == RED ? 1 : -1;
+    for (int pt = 0; pt < TYPES; pt++) {
+      for (int v = 0; v < TYPES; v++) {
+        if (!(Victims[pt] & (1u << v))) continue;
+        for (int k = 0; k < MULTS; k++) out[pt * MULTS + k] += sign * n[us][pt] * bv[v][k];
+      }
+    }
+  }
+}
+
+void coefficients(const Params &p, float c[FEATURES]) {
+  for (int pt = 0; pt < TYPES; pt++) {
+    for (int k = 0; k < MULTS; k++) c[pt * MULTS + k] = p.value[pt] * p.mult[k];
+  }
+}
+
+// Loss and its gradient by feature coefficient over positions [begin, end)
+double pass(const Dataset &d, const float c[FEATURES], double K, size_t begin, size_t end, double grad[FEATURES]) {
+  float lanes[FEATURES][Lanes] = {};
+  double loss = 0;
+  float e[Block], delta[Block];
+  for (size_t b = begin; b < end; b += Block) {
+    std::fill(e, e + Block, 0.0f);
+    for (int j = 0; j < FEATURES; j++) {
+      const float* f = &d.feature[j][b];
+      for (int i = 0; i < Block; i++) e[i] += c[j] * f[i];
+    }
+    const float* t = &d.target[b];
+    for (int i = 0; i < Block; i++) {
+      float s = 1.0f / (1.0f + std::exp(float(-K) * e[i]));
+      float diff = s - t[i];
+      loss += diff * diff;
+      delta[i] = diff * s * (1.0f - s);
+    }
+    for (int j = 0; j < FEATURES; j++) {
+      const float* f = &d.feature[j][b];
+      for (int i = 0; i < Block; i += Lanes) {
+        for (int l = 0; l < Lanes; l++) lanes[j][l] += delta[i + l] * f[i + l];
+      }
+    }
+  }
+  for (int j = 0; j < FEATURES; j++) {
+    grad[j] = 0;
+    for (int l = 0; l < Lanes; l++) grad[j] += lanes[j][l];
+  }
+  return loss;
+}
+
+// Mean loss over the dataset, and the gradient by coefficient
+double evaluate(const Dataset &d, const Params &p, double K, int threads, double grad[FEATURES]) {
+  float c[FEATURES];
+  coefficients(p, c);
+  size_t blocks = d.target.size() / Block;
+  std::vector<double> loss(threads);
+  std::vector<std::vector<double>> grads(threads, std::vector<double>(FEATURES));
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; t++) {
+    pool.emplace_back([&, t]() {
+      size_t begin = blocks * t / threads * Block, end = blocks * (t + 1) / threads * Block;
+      loss[t] = pass(d, c, K, begin, end, grads[t].data());
+    });
+  }
+  for (auto &t : pool) t.join();
+
+  double total = 0;
+  for (int j = 0; j < FEATURES; j++) grad[j] = 0;
+  for (int t = 0; t < threads; t++) {
+    total += loss[t];
+    for (int j = 0; j < FEATURES; j++) grad[j] += grads[t][j] * 2 * K / d.size;
+  }
+  return total / d.size;
+}
+
+// Scale of the sigmoid that best predicts the results with the current
+// values, by golden section on its logarithm
+double fit_scale(const Dataset &d, const Params &p, int threads) {
+  double grad[FEATURES];
+  double lo = std::log(1e-7), hi = std::log(1e-1);
+  const double g = (std::sqrt(5.0) - 1) / 2;
+  for (int i = 0; i < 40; i++) {
+    double a = hi - g * (hi - lo), b = lo + g * (hi - lo);
+    if (evaluate(d, p, std::exp(a), threads, grad) < evaluate(d, p, std::exp(b), threads, grad)) {
+      hi = b;
+    } else {
+      lo = a;
+    }
+  }
+  return std::exp((lo + hi) / 2);
+}
+
+// Adam on the logarithms of the values and, if tuneMults, of the prey
+// and peer multipliers
+double descend(const Dataset &d, Params &p, double K, int threads, int epochs, bool tuneMults) {
+  const int N = TYPES + 2;
+  double m[N] = {}, v[N] = {};
+  double grad[FEATURES], loss = 0;
+  for (int epoch = 1; epoch <= epochs; epoch++) {
+    loss = evaluate(d, p, K, threads, grad);
+    double g[N] = {};
+    for (int pt = 0; pt < TYPES; pt++) {
+      for (int k = 0; k < MULTS; k++) {
+        double dc = grad[pt * MULTS + k];
+        g[pt] += dc * p.mult[k] * p.value[pt];
+        if (k > 0) g[TYPES + k - 1] += dc * p.value[pt] * p.mult[k];
+      }
+    }
+    for (int i = 0; i < N; i++) {
+      if (i >= TYPES && !tuneMults) continue;
+      m[i] = 0.9 * m[i] + 0.1 * g[i];
+      v[i] = 0.999 * v[i] + 0.001 * g[i] * g[i];
+      double mHat = m[i] / (1 - std::pow(0.9, epoch)), vHat = v[i] / (1 - std::pow(0.999, epoch));
+      double &x = i < TYPES ? p.value[i] : p.mult[i - TYPES + 1];
+      x *= std::exp(-LearningRate * mHat / (std::sqrt(vHat) + 1e-12));
+    }
+    if (epoch % 50 == 0) fprintf(stderr, "epoch %d loss %.6f\n", epoch, loss);
+  }
+  return loss;
+}
+
+bool load(const std::string &path, Dataset &d, int threads) {
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f) return false;
+  std::vector<Training::Record> records;
+  Training::Record chunk[4096];
+  for (size_t n; (n = fread(chunk, sizeof(Training::Record), 4096, f)) > 0; ) {
+    records.insert(records.end(), chunk, chunk + n);
+  }
+  fclose(f);
+  if (records.empty()) return false;
+
+  d.size = records.size();
+  size_t padded = (d.size + Block - 1) / Block * Block;
+  for (int j = 0; j < FEATURES; j++) d.feature[j].assign(padded, 0.0f);
+  d.target.assign(padded, 0.5f);
+
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; t++) {
+    pool.emplace_back([&, t]() {
+      float x[FEATURES];
+      for (size_t i = d.size * t / threads; i < d.size * (t + 1) / threads; i++) {
+        features(records[i], x);
+        for (int j = 0; j < FEATURES; j++) d.feature[j][i] = x[j];
+        d.target[i] = (records[i].result + 1) / 2.0f;
+      }
+    });
+  }
+  for (auto &t : pool) t.join();
+
+  // The features restate update_material_score; make sure they still
+  // agree with the board
+  float c[FEATURES];
+  coefficients(current(), c);
+  Board board;
+  for (size_t i = 0; i < std::min<size_t>(d.size, 1000); i++) {
+    Training::unpack(records[i], board);
+    double score = 0;
+    for (int j = 0; j < FEATURES; j++) score += double(c[j]) * d.feature[j][i];
+    if (int(score) != board.get_score(RED) - board.get_score(BLACK)) {
+      fprintf(stderr, "tuner features disagree with the evaluation\n");
+      return false;
+    }
+  }
+  return true;
+}
+
+bool write(const std::string &out, const int value[TYPES], const int mult[MULTS]) {
+  std::string tmp = out + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "w");
+  if (!f) return false;
+  const char* names[TYPES] = {"Pawn", "Cannon", "Knight", "Rook", "Minister", "Guard", "King"};
+  fprintf(f, "#pragma once\n\n"
+             "// Generated by cdc1 --tune; rerun the tuner rather than editing by hand.\n"
+             "// Material values and the basic value multipliers of update_basic_value.\n\n"
+             "namespace DarkChess {\nnamespace EvalParams {\n\n");
+  for (int pt = 0; pt < TYPES; pt++) fprintf(f, "const int %sValue = %d;\n", names[pt], value[pt]);
+  fprintf(f, "const int BonusCapture = %d;\n", EvalParams::BonusCapture);
+  fprintf(f, "const int BvBase = %d;\nconst int BvPrey = %d;\nconst int BvPeer = %d;\n", mult[0], mult[1], mult[2]);
+  fprintf(f, "\n} // namespace EvalParams\n} // namespace DarkChess\n");
+  bool ok = !ferror(f);
+  ok = fclose(f) == 0 && ok;
+  return ok && rename(tmp.c_str(), out.c_str()) == 0;
+}
+
+} // namespace
+
+bool run(const std::string &data, const std::string &out, int threads) {
+  Dataset d;
+  if (!load(data, d, threads)) return false;
+  Params p = current();
+  double K = fit_scale(d, p, threads);
+  double grad[FEATURES];
+  double before = evaluate(d, p, K, threads, grad);
+  fprintf(stderr, "%zu positions, scale %.3g, loss %.6f\n", d.size, K, before);
+
+  descend(d, p, K, threads, Epochs, true);
+
+  // Integer multipliers, then values refitted around them
+  int value[TYPES], mult[MULTS];
+  for (int k = 0; k < MULTS; k++) {
+    mult[k] = std::max(k == 0 ? 1 : 0, int(std::lround(p.mult[k])));
+    p.mult[k] = mult[k];
+  }
+  descend(d, p, K, threads, RefitEpochs, false);
+  for (int pt = 0; pt < TYPES; pt++) {
+    value[pt] = std::max(1, int(std::lround(p.value[pt])));
+    p.value[pt] = value[pt];
+  }
+  fprintf(stderr, "loss %.6f -> %.6f\n", before, evaluate(d, p, K, threads, grad));
+  return write(out, value, mult);
+}
+
+} // namespace Tuner
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+
+/*
+ * Texel-style tuning of the material evaluation.
+ *
+ * The material score is a sum over piece types of the piece value times
+ * the basic values of the pieces it can capture, and each basic value is
+ * BvBase plus BvPrey and BvPeer times counts of the opponent's pieces. So
+ * for fixed multipliers the score is linear in 21 features of the piece
+ * counts (piece type by multiplier), which is all the tuner keeps of a
+ * position: one float array per feature, with the game result as target.
+ *
+ * The loss is the squared error between the result and a sigmoid of the
+ * score, whose scale is fitted first. Gradient descent (Adam, on the
+ * logarithms so everything stays positive) runs over the arrays split
+ * between the threads. The multipliers are then rounded and the values
+ * tuned once more around them, and the result is written as a new
+ * eval_params.h; BvBase sets the scale and BonusCapture only orders
+ * moves, so both are written back unchanged.
+ */
+namespace Tuner {
+
+// Tunes on the training records in data and writes the header to out.
+// Returns false if the data cannot be read or the header written.
+bool run(const std::string &data, const std::string &out, int threads);
+
+} // namespace Tuner
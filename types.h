@@ -3,6 +3,8 @@
 #include <array>
 #include <stdint.h>
 
+#include "eval_params.h"
+
 namespace DarkChess {
 
 enum Move : int {
@@ -31,19 +33,19 @@ enum Value : int {
   VALUE_INFINITE  = 32001,
   VALUE_NONE      = 32002,
 
-  PawnValueMg   = 10,    PawnValueEg   = 213,
-  CannonValueMg = 200,    CannonValueEg = 600,
-  KnightValueMg = 50,    KnightValueEg = 854,
-  RookValueMg   = 75,   RookValueEg   = 1380,
-  MinisterValueMg = 100,  MinisterValueEg = 915,
-  GuardValueMg  = 260,   GuardValueEg   = 2682,
-  KingValue = 320,
+  PawnValueMg   = EvalParams::PawnValue,    PawnValueEg   = 213,
+  CannonValueMg = EvalParams::CannonValue,    CannonValueEg = 600,
+  KnightValueMg = EvalParams::KnightValue,    KnightValueEg = 854,
+  RookValueMg   = EvalParams::RookValue,   RookValueEg   = 1380,
+  MinisterValueMg = EvalParams::MinisterValue,  MinisterValueEg = 915,
+  GuardValueMg  = EvalParams::GuardValue,   GuardValueEg   = 2682,
+  KingValue = EvalParams::KingValue,
 
   MidgameLimit  = 15258,  EndgameLimit = 3915
 };
 
 enum Bonus : int {
-  BONUS_CAPTURE = 10
+  BONUS_CAPTURE = EvalParams::BonusCapture
 };
 
 enum PieceType : int {
@@ -176,6 +178,13 @@ inline int get_piece(Color c, PieceType pt) {
   return get_piece(make_piece(c, pt));
 }
 
+// Inverse of get_piece
+inline Piece piece_of_index(int idx) {
+  if (idx < 7) return Piece(idx);
+  if (idx < PIECE_NB) return Piece(idx + 9);
+  return idx == PIECE_NB ? PIECE_DARK : NO_PIECE;
+}
+
 inline PieceType type_of(Piece pc) {
   return PieceType(pc & 15);
 }
@@ -212,6 +221,24 @@ constexpr bool is_move_ok(Move m) {
   return from_sq(m) != to_sq(m);
 }
 
+// Symmetries of the board: bit 0 mirrors the files, bit 1 the ranks and
+// bit 2 swaps the colours. Each one is its own inverse.
+constexpr int SYMMETRY_NB = 8;
+constexpr int SYM_COLOR = 4;
+
+constexpr Square mirror(Square s, int sym) {
+  return make_square(sym & 1 ? File(FILE_D - file_of(s)) : file_of(s),
+                     sym & 2 ? Rank(RANK_8 - rank_of(s)) : rank_of(s));
+}
+
+constexpr Piece mirror(Piece pc, int sym) {
+  return (sym & SYM_COLOR) && pc < PIECE_DARK ? make_piece(~color_of(pc), type_of(pc)) : pc;
+}
+
+constexpr Move mirror(Move m, int sym) {
+  return m >= MOVE_PASS ? m : make_move(mirror(from_sq(m), sym), mirror(to_sq(m), sym));
+}
+
 inline Bitboard LS1B(Bitboard b) {
   return b & (-b);
 }
@@ -277,7 +304,12 @@ inline Square GetIndex(Bitboard mask) {
   return index32[idx];
 }
 
+// Pieces of each type a side starts with, all of them dark
+const int PieceTotal[KING + 1] = {5, 2, 2, 2, 2, 2, 1};
+
 extern uint64_t hashArray[SQUARE_NB][PIECE_NB+1];
 extern uint64_t hashTurn;
+extern uint64_t hashPool[PIECE_NB][6]; // by piece and number still hidden
+extern uint64_t hashSym[SYMMETRY_NB][SQUARE_NB][PIECE_NB+1]; // hashArray of the mirrored piece
 
 } // namespace DarkChess
\ No newline at end of file